@@ -0,0 +1,120 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+
+/*----Arena allocation----*/
+//Bump allocator for data that lives and dies together, like a scene. Allocation moves
+//a pointer through a large block; nothing is freed individually. Reset() drops everything
+//at once and keeps the memory, merged into one block, for the next user. Only trivially
+//destructible types may go in, since no destructors are ever run.
+
+template<class T>
+struct Span
+{
+	T *data = nullptr;
+	size_t size = 0;
+
+	T &operator[](size_t i) const { return data[i]; }
+	T *begin() const { return data; }
+	T *end() const { return data + size; }
+	bool empty() const { return size == 0; }
+};
+
+class Arena
+{
+public:
+	explicit Arena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+
+	Arena(const Arena&) = delete;
+	Arena &operator=(const Arena&) = delete;
+
+	void *Allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+	{
+		size_t offset = (used + align - 1) & ~(align - 1);
+		if (blocks.empty() || offset + bytes > blocks.back().size)
+		{
+			NewBlock(std::max(bytes + align, blockSize));
+			offset = (used + align - 1) & ~(align - 1);
+		}
+		used = offset + bytes;
+		allocated += bytes;
+		return blocks.back().data.get() + offset;
+	}
+
+	// Uninitialised array of n T
+	template<class T>
+	Span<T> Allocate(size_t n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena never runs destructors");
+		if (n == 0) return Span<T>();
+		return { static_cast<T*>(Allocate(n * sizeof(T), alignof(T))), n };
+	}
+
+	template<class T>
+	Span<T> Copy(const T *src, size_t n)
+	{
+		Span<T> s = Allocate<T>(n);
+		if (n) std::memcpy(static_cast<void*>(s.data), src, n * sizeof(T));
+		return s;
+	}
+
+	template<class T>
+	Span<T> Copy(const std::vector<T> &src) { return Copy(src.data(), src.size()); }
+
+	// Forget every allocation. Memory is kept; if it had grown past one block it is
+	// replaced by a single block of the same total size, so the next job is contiguous
+	void Reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t total = Reserved();
+			blocks.clear();
+			NewBlock(total);
+		}
+		used = 0;
+		allocated = 0;
+	}
+
+	// Free all memory
+	void Release()
+	{
+		blocks.clear();
+		used = 0;
+		allocated = 0;
+	}
+
+	size_t BytesUsed() const { return allocated; }		//Requested, excluding alignment padding
+
+	size_t Reserved() const
+	{
+		size_t total = 0;
+		for (const Block &b : blocks) total += b.size;
+		return total;
+	}
+
+private:
+	struct Block
+	{
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t blockSize, used = 0, allocated = 0;
+
+	void NewBlock(size_t size)
+	{
+		blocks.push_back({ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+		used = 0;
+	}
+};
+
+#endif
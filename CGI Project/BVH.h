@@ -0,0 +1,253 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Stats.h"
+#include "Vec3.h"
+
+
+/*----Bounding boxes----*/
+
+struct AABB
+{
+	Vec3 lo = { INFINITY, INFINITY, INFINITY },
+		 hi = { -INFINITY, -INFINITY, -INFINITY };
+
+	void Grow(const Vec3 &p)
+	{
+		lo = { std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z) };
+		hi = { std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z) };
+	}
+
+	void Grow(const AABB &b) { if (!b.Empty()) { Grow(b.lo); Grow(b.hi); } }
+
+	bool Empty() const { return lo.x > hi.x; }
+	Vec3 Centre() const { return 0.5*(lo + hi); }
+
+	double Area() const		//Half the surface area, all the SAH needs
+	{
+		if (Empty()) return 0.0;
+		Vec3 e = hi - lo;
+		return e.x*e.y + e.y*e.z + e.z*e.x;
+	}
+};
+
+
+/*----Bounding volume hierarchy----*/
+//Binned SAH build over any set of primitive bounds. The tree only stores primitive
+//indices; the owner decides what a primitive is and how to intersect it. Trees are at
+//most MaxDepth levels deep, so traversal's fixed stack cannot overflow.
+
+struct BVHNode
+{
+	float lo[3], hi[3];		//Rounded outwards from the double bounds
+	int leftFirst;			//Leaf: first entry in BVH::indices. Inner: left child, right child follows it
+	int count;				//Number of primitives, 0 for inner nodes
+};
+
+class BVH
+{
+public:
+	static const int MaxDepth = 128;	//Levels below the root, bounding the traversal stack
+
+	std::vector<BVHNode> nodes;
+	std::vector<int> indices;		//Primitive indices in leaf order
+
+	void Build(const std::vector<AABB> &bounds, int maxLeafSize = 4)
+	{
+		nodes.clear(); indices.resize(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++) indices[i] = int(i);
+		if (bounds.empty()) return;
+
+		centres.resize(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++) centres[i] = bounds[i].Centre();
+
+		nodes.reserve(2 * bounds.size());
+		nodes.push_back(BVHNode());
+		Subdivide(0, 0, int(bounds.size()), 0, bounds, maxLeafSize);
+
+		centres.clear(); centres.shrink_to_fit();
+		nodes.shrink_to_fit();
+	}
+
+	bool Empty() const { return nodes.empty(); }
+
+	AABB Bounds() const
+	{
+		AABB b;
+		if (!nodes.empty())
+		{
+			b.lo = { nodes[0].lo[0], nodes[0].lo[1], nodes[0].lo[2] };
+			b.hi = { nodes[0].hi[0], nodes[0].hi[1], nodes[0].hi[2] };
+		}
+		return b;
+	}
+
+	// Closest-hit traversal, near child first. hit(first, count, tMax) tests the leaf's
+	// primitives indices[first..first+count) and shortens tMax when it finds a closer one
+	template<class LeafFn>
+	void Traverse(const Vec3 &org, const Vec3 &dir, double &tMax, LeafFn hit) const
+	{
+		Traverse(nodes.data(), nodes.size(), org, dir, tMax, hit);
+	}
+
+	// Same over a node array kept elsewhere, e.g. copied into an arena
+	template<class LeafFn>
+	static void Traverse(const BVHNode *nodes, size_t count, const Vec3 &org, const Vec3 &dir, double &tMax, LeafFn hit)
+	{
+		if (count == 0) return;
+		const Vec3 inv = { 1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z };
+
+		int stack[StackSize], top = 0, node = 0;
+		if (Slab(nodes[0], org, inv, tMax) == INFINITY) return;
+
+		while (true)
+		{
+			const BVHNode &n = nodes[node];
+			STAT(nodeVisits);
+			if (n.count > 0)
+			{
+				hit(n.leftFirst, n.count, tMax);
+			}
+			else
+			{
+				int a = n.leftFirst, b = n.leftFirst + 1;
+				double ta = Slab(nodes[a], org, inv, tMax), tb = Slab(nodes[b], org, inv, tMax);
+				if (ta > tb) { std::swap(ta, tb); std::swap(a, b); }
+
+				if (ta != INFINITY)
+				{
+					if (tb != INFINITY) stack[top++] = b;		//At most one entry per level above node
+					node = a;
+					continue;
+				}
+			}
+			if (top == 0) return;
+			node = stack[--top];
+		}
+	}
+
+private:
+	static const int Bins = 16, StackSize = MaxDepth,
+					 MedianDepth = MaxDepth - 32;	//Deeper, split at the median, which halves the count every level
+	std::vector<Vec3> centres;
+
+	// Entry distance of the ray into the node's box, INFINITY if it misses before tMax
+	static double Slab(const BVHNode &n, const Vec3 &o, const Vec3 &inv, double tMax)
+	{
+		double	tx1 = (n.lo[0] - o.x)*inv.x, tx2 = (n.hi[0] - o.x)*inv.x,
+				ty1 = (n.lo[1] - o.y)*inv.y, ty2 = (n.hi[1] - o.y)*inv.y,
+				tz1 = (n.lo[2] - o.z)*inv.z, tz2 = (n.hi[2] - o.z)*inv.z,
+				tmin = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2)),
+				tmax = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+		return (tmax >= tmin && tmax > 0 && tmin < tMax) ? tmin : INFINITY;
+	}
+
+	static void SetBounds(BVHNode &n, const AABB &b)
+	{
+		n.lo[0] = std::nextafter(float(b.lo.x), -INFINITY); n.hi[0] = std::nextafter(float(b.hi.x), INFINITY);
+		n.lo[1] = std::nextafter(float(b.lo.y), -INFINITY); n.hi[1] = std::nextafter(float(b.hi.y), INFINITY);
+		n.lo[2] = std::nextafter(float(b.lo.z), -INFINITY); n.hi[2] = std::nextafter(float(b.hi.z), INFINITY);
+	}
+
+	static double Axis(const Vec3 &v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+	void Subdivide(int node, int first, int count, int depth, const std::vector<AABB> &bounds, int maxLeafSize)
+	{
+		AABB box, centreBox;
+		for (int i = first; i < first + count; i++)
+		{
+			box.Grow(bounds[indices[i]]);
+			centreBox.Grow(centres[indices[i]]);
+		}
+		SetBounds(nodes[node], box);
+		nodes[node].leftFirst = first;
+		nodes[node].count = count;
+		if (count <= maxLeafSize) return;
+
+		//Skewed inputs, e.g. centres spaced geometrically, can make the SAH peel off a few
+		//primitives per level. Past MedianDepth, split at the median centre on the widest axis
+		if (depth >= MedianDepth && count > 1)
+		{
+			Vec3 e = centreBox.hi - centreBox.lo;
+			int axis = e.x >= e.y && e.x >= e.z ? 0 : (e.y >= e.z ? 1 : 2);
+			std::nth_element(&indices[first], &indices[first] + count / 2, &indices[first] + count, [&](int a, int b)
+			{
+				return Axis(centres[a], axis) < Axis(centres[b], axis);
+			});
+			Split(node, first, first + count / 2, count, depth, bounds, maxLeafSize);
+			return;
+		}
+
+		//Binned SAH: sweep bin boundaries on every axis and keep the cheapest split
+		int bestAxis = -1, bestSplit = 0;
+		double bestCost = count * box.Area();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double lo = Axis(centreBox.lo, axis), extent = Axis(centreBox.hi, axis) - lo, scale = Bins / extent;
+			if (extent <= 0 || !std::isfinite(scale)) continue;		//A subnormal extent would overflow the bin index
+
+			AABB binBox[Bins];
+			int binCount[Bins] = {};
+			for (int i = first; i < first + count; i++)
+			{
+				int b = std::min(Bins - 1, int((Axis(centres[indices[i]], axis) - lo)*scale));
+				binBox[b].Grow(bounds[indices[i]]);
+				binCount[b]++;
+			}
+
+			double leftArea[Bins - 1];
+			int leftCount[Bins - 1];
+			AABB acc;
+			int n = 0;
+			for (int b = 0; b < Bins - 1; b++)
+			{
+				acc.Grow(binBox[b]); n += binCount[b];
+				leftArea[b] = acc.Area(); leftCount[b] = n;
+			}
+			acc = AABB(); n = 0;
+			for (int b = Bins - 1; b > 0; b--)
+			{
+				acc.Grow(binBox[b]); n += binCount[b];
+				double cost = leftCount[b - 1] * leftArea[b - 1] + n * acc.Area();
+				if (leftCount[b - 1] > 0 && n > 0 && cost < bestCost)
+				{
+					bestCost = cost; bestAxis = axis; bestSplit = b;
+				}
+			}
+		}
+
+		int mid;
+		if (bestAxis >= 0)
+		{
+			double lo = Axis(centreBox.lo, bestAxis), scale = Bins / (Axis(centreBox.hi, bestAxis) - lo);
+			int *split = std::partition(&indices[first], &indices[first] + count, [&](int p)
+			{
+				return std::min(Bins - 1, int((Axis(centres[p], bestAxis) - lo)*scale)) < bestSplit;
+			});
+			mid = int(split - &indices[0]);
+		}
+		else if (count > 4 * maxLeafSize)
+		{
+			//No split beats a leaf (e.g. all centres coincide), but the leaf is too big: halve by count
+			mid = first + count / 2;
+		}
+		else return;
+		Split(node, first, mid, count, depth, bounds, maxLeafSize);
+	}
+
+	// Make node an inner node over indices [first, mid) and [mid, first + count)
+	void Split(int node, int first, int mid, int count, int depth, const std::vector<AABB> &bounds, int maxLeafSize)
+	{
+		int left = int(nodes.size());
+		nodes.push_back(BVHNode()); nodes.push_back(BVHNode());
+		nodes[node].leftFirst = left;
+		nodes[node].count = 0;
+		Subdivide(left, first, mid - first, depth + 1, bounds, maxLeafSize);
+		Subdivide(left + 1, mid, first + count - mid, depth + 1, bounds, maxLeafSize);
+	}
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/*----Benchmark harness----*/
+//Each benchmark is a function that does a fixed amount of work and returns how many
+//items (rays, samples, calls...) it processed. It is run a few times untimed to warm
+//caches and clocks, then timed over several repetitions; the median is the headline
+//figure and the spread shows how far to trust it.
+
+inline volatile char keepResultSink;
+
+// Keeps a result alive so the optimiser cannot drop the work that produced it
+template<class T>
+inline void KeepResult(const T &value)
+{
+	const volatile char *p = reinterpret_cast<const volatile char*>(&value);
+	keepResultSink = p[0];
+}
+
+struct BenchResult
+{
+	std::string name, unit;
+	uint64_t items = 0;				//Per repetition
+	std::vector<double> seconds;	//One per repetition, sorted
+
+	double Min() const { return seconds.front(); }
+	double Median() const
+	{
+		size_t n = seconds.size();
+		return (n % 2) ? seconds[n / 2] : 0.5*(seconds[n / 2 - 1] + seconds[n / 2]);
+	}
+	double Mean() const
+	{
+		double s = 0.0;
+		for (double t : seconds) s += t;
+		return s / seconds.size();
+	}
+	double StdDev() const
+	{
+		if (seconds.size() < 2) return 0.0;
+		double m = Mean(), s = 0.0;
+		for (double t : seconds) s += (t - m)*(t - m);
+		return std::sqrt(s / (seconds.size() - 1));
+	}
+
+	double PerSecond() const { return items / Median(); }
+	double NsPerItem() const { return 1e9 * Median() / items; }
+};
+
+class BenchSuite
+{
+public:
+	int warmup, repetitions;
+	std::vector<BenchResult> results;
+
+	BenchSuite(int warmup = 1, int repetitions = 7) : warmup(warmup), repetitions(std::max(repetitions, 1)) {}
+
+	// Run fn (returning the items it processed) warmup + repetitions times, timing the repetitions
+	template<class Fn>
+	const BenchResult &Run(const std::string &name, const std::string &unit, Fn fn)
+	{
+		typedef std::chrono::steady_clock Clock;
+		BenchResult r;
+		r.name = name;
+		r.unit = unit;
+
+		for (int i = 0; i < warmup; i++) fn();
+		for (int i = 0; i < repetitions; i++)
+		{
+			Clock::time_point start = Clock::now();
+			r.items = fn();
+			r.seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+		}
+		std::sort(r.seconds.begin(), r.seconds.end());
+		results.push_back(r);
+		return results.back();
+	}
+
+	void PrintTable(std::ostream &os) const
+	{
+		os << std::left << std::setw(24) << "benchmark" << std::right
+		   << std::setw(16) << "per second" << std::setw(14) << "ns/item"
+		   << std::setw(10) << "+-%" << "  unit" << std::endl;
+		for (const BenchResult &r : results)
+		{
+			os << std::left << std::setw(24) << r.name << std::right << std::fixed
+			   << std::setw(16) << std::setprecision(0) << r.PerSecond()
+			   << std::setw(14) << std::setprecision(2) << r.NsPerItem()
+			   << std::setw(10) << std::setprecision(1) << 100.0 * r.StdDev() / r.Mean()
+			   << "  " << r.unit << std::endl;
+		}
+		os.unsetf(std::ios::fixed);
+	}
+
+	// One object per benchmark, times in seconds. context holds extra top-level fields
+	void WriteJSON(std::ostream &os, const std::vector<std::pair<std::string, std::string> > &context = {}) const
+	{
+		os << "{\n";
+		for (const auto &c : context) os << "  \"" << c.first << "\": \"" << c.second << "\",\n";
+		os << "  \"warmup\": " << warmup << ",\n  \"repetitions\": " << repetitions << ",\n  \"benchmarks\": [\n";
+		os << std::setprecision(9);
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult &r = results[i];
+			os << "    { \"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"items\": " << r.items
+			   << ", \"min\": " << r.Min() << ", \"median\": " << r.Median() << ", \"mean\": " << r.Mean()
+			   << ", \"stddev\": " << r.StdDev() << ", \"per_second\": " << r.PerSecond()
+			   << ", \"ns_per_item\": " << r.NsPerItem() << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		os << "  ]\n}" << std::endl;
+	}
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "PngWriter.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HEATMAP_RDTSC
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HEATMAP_RDTSC
+#endif
+
+
+/*----Per-pixel render cost----*/
+//Time spent on each pixel, read from the cycle counter around its PixVal, shown as a
+//false-colour image and summarised as a histogram. Costs are only compared with each
+//other, so the counter's unit does not matter: TSC ticks on x86, nanoseconds elsewhere.
+
+inline uint64_t CycleCount()
+{
+#ifdef HEATMAP_RDTSC
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+inline const char *CycleUnit()
+{
+#ifdef HEATMAP_RDTSC
+	return "cycles";
+#else
+	return "ns";
+#endif
+}
+
+class PixelCostMap
+{
+public:
+	PixelCostMap(int w, int h) : width(w), height(h), cost(size_t(w)*h, 0) {}
+
+	void Add(int x, int y, uint64_t c) { cost[x + size_t(y)*width] += c; }
+	uint64_t operator()(int x, int y) const { return cost[x + size_t(y)*width]; }
+
+	uint64_t Total() const
+	{
+		uint64_t t = 0;
+		for (uint64_t c : cost) t += c;
+		return t;
+	}
+
+	// Cost at fraction q (0 to 1) of the way through the sorted pixels
+	uint64_t Quantile(double q) const
+	{
+		std::vector<uint64_t> sorted(cost);
+		size_t i = std::min(sorted.size() - 1, size_t(q * (sorted.size() - 1) + 0.5));
+		std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+		return sorted[i];
+	}
+
+	// Write the costs as a PNG on a log scale from the 1st to the 99.9th percentile,
+	// black through blue, red and yellow to white. Returns 0 on success, 1 on error
+	int SaveHeatmap(const std::string &filename) const
+	{
+		double lo = std::log(double(std::max<uint64_t>(Quantile(0.01), 1))),
+			   hi = std::log(double(std::max<uint64_t>(Quantile(0.999), 1)));
+		if (hi <= lo) hi = lo + 1.0;
+
+		std::vector<unsigned char> rgb(size_t(3)*width*height);
+		for (size_t i = 0; i < cost.size(); i++)
+		{
+			double v = (std::log(double(std::max<uint64_t>(cost[i], 1))) - lo) / (hi - lo);
+			Ramp(std::min(std::max(v, 0.0), 1.0), &rgb[3*i]);
+		}
+
+		PngWriter png;
+		if (!png.Open(filename, width, height)) return 1;
+		png.WriteRows(rgb.data(), height);
+		return !png.Close();
+	}
+
+	// Pixels per power-of-two cost band, with the share of the total time each band took
+	void WriteHistogram(std::ostream &os) const
+	{
+		std::vector<uint64_t> pixels(64, 0), spent(64, 0);
+		for (uint64_t c : cost)
+		{
+			int b = 0;
+			while (b < 63 && (c >> (b + 1))) b++;
+			pixels[b]++;
+			spent[b] += c;
+		}
+
+		uint64_t total = std::max<uint64_t>(Total(), 1);
+		int first = 0, last = 63;
+		while (first < 63 && !pixels[first]) first++;
+		while (last > first && !pixels[last]) last--;
+
+		os << CycleUnit() << " from, to, pixels, % of time" << std::endl;
+		for (int b = first; b <= last; b++)
+			os << (uint64_t(1) << b) << ", " << (b < 63 ? (uint64_t(1) << (b + 1)) : ~uint64_t(0)) << ", " << pixels[b] << ", "
+			   << std::fixed << std::setprecision(1) << 100.0 * spent[b] / total << std::defaultfloat << std::setprecision(6)
+			   << "\t" << std::string(size_t(60.0 * pixels[b] / cost.size() + 0.5), '#') << std::endl;
+	}
+
+private:
+	int width, height;
+	std::vector<uint64_t> cost;		//Row-major
+
+	static void Ramp(double v, unsigned char *out)
+	{
+		static const double stops[5][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 } };
+		double f = v * 4.0;
+		int i = std::min(int(f), 3);
+		f -= i;
+		for (int k = 0; k < 3; k++)
+			out[k] = (unsigned char)std::lround(255.0 * (stops[i][k] + f * (stops[i + 1][k] - stops[i][k])));
+	}
+};
+
+#endif
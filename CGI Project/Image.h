@@ -3,55 +3,189 @@
 
 #include <algorithm>
 #include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
 #include <vector>
-
-// See https://github.com/nothings/stb
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include "Morton.h"
+#include "Parallel.h"
+#include "Pixel.h"
+#include "PngWriter.h"
+#include "Tonemap.h"
 #include "Vec3.h"
 
-class Image {
+enum class PixelLayout {
+    RowMajor,   // data[x + y*width]
+    Tiled       // TileSize x TileSize tiles stored row by row, pixels in Z-order inside each tile
+};
+
+// Framebuffer holding pixels in the given storage type (Vec3, Vec3f or Half3, see Pixel.h).
+// Pixels are converted from and to Vec3 only when written and when read back or saved
+template<class Pixel>
+class BasicImage {
 public:
-    Image(int w, int h) : width(w), height(h), data(w*h) {}
+    typedef PixelTraits<Pixel> Traits;
+    static const int TileBits = 3, TileSize = 1 << TileBits;
+
+    BasicImage(int w, int h, PixelLayout layout = PixelLayout::RowMajor)
+        : width(w), height(h), tilesX((w + TileSize - 1) / TileSize), layout(layout),
+          data(layout == PixelLayout::Tiled ? size_t(tilesX)*((h + TileSize - 1) / TileSize)*TileSize*TileSize
+                                            : size_t(w)*h) {}
 
     Vec3 operator()(int x, int y) const {
-		if (x<0 || x>=width || y<0 || y>=width) throw;
-        return data[x+y*width];
-    }
-
-    Vec3 &operator()(int x, int y) {
-		if (x<0 || x>=width || y<0 || y>=width) throw;
-        return data[x+y*width];
-    }
-
-    int Save(std::string filename) {
-        chardata = std::vector<unsigned char>(width*height*3);
-        double a;
-		int index;
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                index = x + width*y;
-                a = std::min(std::max(data[index].x,0.0),1.0);
-                chardata[index*3] = 255.0*std::pow(a,1/2.2);
-                a = std::min(std::max(data[index].y,0.0),1.0);
-                chardata[index*3+1] = 255.0*std::pow(a,1/2.2);
-                a = std::min(std::max(data[index].z,0.0),1.0);
-                chardata[index*3+2] = 255.0*std::pow(a,1/2.2);
-            }
+        return Traits::Load(data[Index(x, y)]);
+    }
+
+    void Set(int x, int y, const Vec3 &v) {
+        data[Index(x, y)] = Traits::Store(v);
+    }
+
+    void Accumulate(int x, int y, const Vec3 &v) {
+        Pixel &p = data[Index(x, y)];
+        p = Traits::Store(Traits::Load(p) + v);
+    }
+
+    // Raw storage access, no conversion
+    Pixel &At(int x, int y) { return data[Index(x, y)]; }
+
+    // Call fn(tile) for each TileSize tile of the frame, in Z-order
+    template<class Fn>
+    void ForEachTile(Fn fn) const {
+        for (const TileRect &tile : MortonTiles(width, height, TileSize)) fn(tile);
+    }
+
+    // Tonemap to 8-bit and write a PNG. Rows are converted in parallel through a
+    // precomputed transfer curve instead of calling std::pow per channel
+    int Save(std::string filename, const ToneMapSettings &settings = ToneMapSettings(),
+             int pngLevel = PngWriter::Default) {
+        PngWriter png(pngLevel);
+        if (!png.Open(filename, width, height)) return 1;
+        WriteRows(png, height, settings);
+        return !png.Close();
+    }
+
+    // Stream the first nRows rows to an open PNG, a strip of about 4MB at a time, so the
+    // 8-bit copy stays small but each strip still splits into several deflate pieces
+    bool WriteRows(PngWriter &png, int nRows, const ToneMapSettings &settings = ToneMapSettings()) const {
+        const int StripRows = std::max(16, (4 << 20) / (3*width));
+        ToneMapper tonemap(settings);
+        std::vector<unsigned char> strip(size_t(3)*width*StripRows);
+
+        for (int y0 = 0; y0 < nRows; y0 += StripRows) {
+            int rows = std::min(StripRows, nRows - y0);
+            ParallelFor(0, rows, 1, [&](int r0, int r1) {
+                std::vector<float> row(3*width);
+                for (int r = r0; r < r1; r++) {
+                    int y = y0 + r;
+                    if (layout == PixelLayout::RowMajor) {
+                        const Pixel *src = &data[size_t(width)*y];
+                        for (int x = 0; x < width; x++)
+                            Traits::ToFloat(src[x], &row[3*x]);
+                    }
+                    else {
+                        for (int x = 0; x < width; x++)
+                            Traits::ToFloat(data[Offset(x, y)], &row[3*x]);
+                    }
+                    tonemap.Apply(row.data(), &strip[size_t(3)*width*r], 3*width);
+                }
+            });
+            if (!png.WriteRows(strip.data(), rows)) return false;
         }
+        return true;
+    }
 
-        return !stbi_write_png(filename.c_str(), width, height,
-                               3, &(chardata[0]), 3*width);
+    // Write the unclamped radiance as a little-endian PFM (rows bottom to top)
+    int SavePFM(const std::string &filename) const {
+        std::ofstream ofs(filename, std::ios::binary);
+        if (!ofs.is_open()) return 1;
+        ofs << "PF\n" << width << " " << height << "\n-1.0\n";
+
+        std::vector<float> row(3*width);
+        for (int y = height - 1; y >= 0; y--) {
+            for (int x = 0; x < width; x++)
+                Traits::ToFloat(data[Offset(x, y)], &row[3*x]);
+            ofs.write(reinterpret_cast<const char*>(row.data()), std::streamsize(row.size()*sizeof(float)));
+        }
+        return ofs.good() ? 0 : 1;
     }
 
-    int Width() { return width; }
-    int Height() { return height; }
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    PixelLayout Layout() const { return layout; }
+    size_t Bytes() const { return data.size()*sizeof(Pixel); }
 
 private:
-    int width, height;
-    std::vector<unsigned char> chardata;
-    std::vector<Vec3> data;
+    int width, height, tilesX;
+    PixelLayout layout;
+    std::vector<Pixel> data;
+
+    size_t Index(int x, int y) const {
+        if (x<0 || x>=width || y<0 || y>=height) throw std::out_of_range("Image: pixel outside the frame");
+        return Offset(x, y);
+    }
+
+    size_t Offset(int x, int y) const {
+        if (layout == PixelLayout::RowMajor) return x + size_t(y)*width;
+        size_t tile = size_t(x >> TileBits) + size_t(y >> TileBits)*tilesX;
+        return (tile << (2*TileBits)) | MortonEncode(x & (TileSize - 1), y & (TileSize - 1));
+    }
 };
 
+typedef BasicImage<Vec3f> Image;		//Float is plenty for accumulated radiance
+typedef BasicImage<Vec3> ImageD;
+typedef BasicImage<Half3> ImageH;
+
+// Read a PFM written by SavePFM (or any little-endian colour PFM). Returns 0 on success, 1 on error
+template<class Pixel>
+int LoadPFM(const std::string &filename, BasicImage<Pixel> &img) {
+    std::ifstream ifs(filename, std::ios::binary);
+    std::string magic;
+    int w = 0, h = 0;
+    float scale = 0.0f;
+    if (!(ifs >> magic >> w >> h >> scale) || magic != "PF" || w <= 0 || h <= 0 || scale >= 0.0f) return 1;
+    ifs.get();      // Single whitespace character before the data
+
+    img = BasicImage<Pixel>(w, h, img.Layout());
+    std::vector<float> row(3*size_t(w));
+    for (int y = h - 1; y >= 0; y--) {
+        if (!ifs.read(reinterpret_cast<char*>(row.data()), std::streamsize(row.size()*sizeof(float)))) return 1;
+        for (int x = 0; x < w; x++)
+            img.Set(x, y, Vec3(row[3*x], row[3*x + 1], row[3*x + 2]));
+    }
+    return 0;
+}
+
+// Root mean square difference over all channels. The images must be the same size
+template<class A, class B>
+double RMSE(const BasicImage<A> &a, const BasicImage<B> &b) {
+    double sum = 0.0;
+    for (int y = 0; y < a.Height(); y++)
+        for (int x = 0; x < a.Width(); x++) {
+            Vec3 d = a(x, y) - b(x, y);
+            sum += d.norm2();
+        }
+    return std::sqrt(sum / (3.0*a.Width()*a.Height()));
+}
+
+// Relative MSE: squared difference over squared reference, averaged over all channels, so
+// dark and bright regions count alike. epsilon keeps black reference pixels from dominating
+template<class A, class B>
+double RelMSE(const BasicImage<A> &img, const BasicImage<B> &reference, double epsilon = 0.01) {
+    double sum = 0.0;
+    for (int y = 0; y < img.Height(); y++)
+        for (int x = 0; x < img.Width(); x++) {
+            Vec3 a = img(x, y), b = reference(x, y), d = a - b;
+            sum += d.x*d.x / (b.x*b.x + epsilon) + d.y*d.y / (b.y*b.y + epsilon) + d.z*d.z / (b.z*b.z + epsilon);
+        }
+    return sum / (3.0*img.Width()*img.Height());
+}
+
+// Peak signal-to-noise ratio in dB, for radiance where peak is full white
+template<class A, class B>
+double PSNR(const BasicImage<A> &img, const BasicImage<B> &reference, double peak = 1.0) {
+    double rmse = RMSE(img, reference);
+    return rmse > 0.0 ? 20.0*std::log10(peak / rmse) : INFINITY;
+}
+
 #endif
@@ -0,0 +1,91 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <vector>
+#include "BVH.h"
+#include "Mesh.h"
+#include "Transform.h"
+#include "Vec3.h"
+
+
+/*----Instancing----*/
+//Many placements of shared meshes. Each instance holds a pointer to its mesh (and through
+//it the mesh's BVH) plus a local-to-world transform and its inverse. A top-level BVH over
+//the instances' world bounds finds candidate instances; the ray is then moved into the
+//instance's space and traced against the shared bottom-level BVH.
+
+struct MeshInstance
+{
+	const TriangleMesh *mesh;
+	Transform toWorld, toLocal;
+	AABB bounds;		//World space
+};
+
+class InstanceSet
+{
+public:
+	std::vector<MeshInstance> instances;
+	BVH tlas;
+
+	// Add an instance. Build() must run before tracing
+	int Add(const TriangleMesh *mesh, const Transform &toWorld)
+	{
+		instances.push_back({ mesh, toWorld, toWorld.Inverse(), AABB() });
+		instances.back().bounds = WorldBounds(instances.back());
+		return int(instances.size()) - 1;
+	}
+
+	// Move an instance. Only the top level needs rebuilding afterwards, the mesh is untouched
+	void SetTransform(int i, const Transform &toWorld)
+	{
+		MeshInstance &inst = instances[i];
+		inst.toWorld = toWorld;
+		inst.toLocal = toWorld.Inverse();
+		inst.bounds = WorldBounds(inst);
+	}
+
+	// (Re)build the top-level BVH over the instance bounds
+	void Build()
+	{
+		std::vector<AABB> bounds(instances.size());
+		for (size_t i = 0; i < instances.size(); i++) bounds[i] = instances[i].bounds;
+		tlas.Build(bounds, 1);
+	}
+
+	bool Intersect(const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal) const
+	{
+		bool hit = false;
+		tlas.Traverse(org, dir, tMax, [&](int first, int count, double &tClosest)
+		{
+			for (int k = first; k < first + count; k++)
+			{
+				const MeshInstance &inst = instances[tlas.indices[k]];
+				Vec3 localNormal;
+
+				//The local direction is not renormalised, so t means the same distance in both spaces
+				if (inst.mesh->Intersect(inst.toLocal.Point(org), inst.toLocal.Vector(dir), tClosest, localNormal))
+				{
+					normal = inst.toLocal.TransposeVector(localNormal);
+					hit = true;
+				}
+			}
+		});
+		if (hit) normal.normalise();
+		return hit;
+	}
+
+private:
+	static AABB WorldBounds(const MeshInstance &inst)
+	{
+		AABB local = inst.mesh->Bounds(), world;
+		for (int c = 0; c < 8; c++)
+		{
+			world.Grow(inst.toWorld.Point(Vec3(	(c & 1) ? local.hi.x : local.lo.x,
+												(c & 2) ? local.hi.y : local.lo.y,
+												(c & 4) ? local.hi.z : local.lo.z)));
+		}
+		return world;
+	}
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/*----Read-only memory-mapped file----*/
+//The whole file is mapped and pages are read in by the OS as they are touched, so
+//opening costs the same whatever the file size.
+
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+	// Map filename. Returns 0 on success, 1 on error. Empty files cannot be mapped
+	int Open(const std::string &filename)
+	{
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return 1;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { Close(); return 1; }
+		size = size_t(fileSize.QuadPart);
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) { Close(); return 1; }
+		data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!data) { Close(); return 1; }
+#else
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return 1;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) { Close(); return 1; }
+		size = size_t(st.st_size);
+
+		void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) { Close(); return 1; }
+		data = static_cast<const unsigned char*>(p);
+#endif
+		return 0;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data) munmap(const_cast<unsigned char*>(data), size);
+		if (fd >= 0) close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const unsigned char *Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BVH.h"
+#include "file_loading.h"
+#include "Stats.h"
+#include "Vec3.h"
+
+
+/*----Triangle mesh geometry----*/
+//Indexed triangles with their own BVH. Materials live in the Scene that references the mesh,
+//so one mesh can be shared by several primitives.
+
+class TriangleMesh
+{
+public:
+	std::vector<Vec3f> vertices;
+	std::vector<uint32_t> indices;		//Three vertex indices per triangle
+	BVH bvh;
+
+	size_t Triangles() const { return indices.size() / 3; }
+
+	// Build the BVH and reorder the triangles into leaf order, so leaves index them directly
+	void BuildBVH(int maxLeafSize = 4)
+	{
+		std::vector<AABB> bounds(Triangles());
+		for (size_t t = 0; t < bounds.size(); t++)
+			for (int k = 0; k < 3; k++) bounds[t].Grow(Vertex(t, k));
+		bvh.Build(bounds, maxLeafSize);
+
+		std::vector<uint32_t> sorted(indices.size());
+		for (size_t i = 0; i < bvh.indices.size(); i++)
+		{
+			size_t t = size_t(bvh.indices[i]);
+			sorted[3*i] = indices[3*t]; sorted[3*i + 1] = indices[3*t + 1]; sorted[3*i + 2] = indices[3*t + 2];
+			bvh.indices[i] = int(i);
+		}
+		indices.swap(sorted);
+	}
+
+	AABB Bounds() const
+	{
+		if (!bvh.Empty()) return bvh.Bounds();
+		AABB b;
+		for (const Vec3f &v : vertices) b.Grow(ToVec3(v));
+		return b;
+	}
+
+	// Closest triangle hit closer than tMax. On a hit tMax is shortened and the
+	// geometric normal of the triangle is returned in normal
+	bool Intersect(const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal) const
+	{
+		WatertightRay ray(org, dir);
+		size_t hitTri = SIZE_MAX;
+
+		bvh.Traverse(org, dir, tMax, [&](int first, int count, double &tClosest)
+		{
+			STAT_ADD(triangleTests, count);
+			for (int t = first; t < first + count; t++)
+				if (ray.Intersect(Vertex(t, 0), Vertex(t, 1), Vertex(t, 2), tClosest))
+					hitTri = size_t(t);
+		});
+
+		if (hitTri == SIZE_MAX) return false;
+		normal = cross(Vertex(hitTri, 1) - Vertex(hitTri, 0), Vertex(hitTri, 2) - Vertex(hitTri, 0));
+		normal.normalise();
+		return true;
+	}
+
+private:
+	Vec3 Vertex(size_t tri, int k) const { return ToVec3(vertices[indices[3*tri + k]]); }
+
+	// Woop, Benthin and Wald's watertight ray/triangle test. The ray is sheared so it
+	// runs along +z, then edge functions are evaluated in 2D, so rays through a shared
+	// edge or vertex never slip between the triangles around it: at least one reports a
+	// hit, though both sides of an edge can
+	struct WatertightRay
+	{
+		Vec3 org;
+		int kx, ky, kz;
+		double sx, sy, sz;
+
+		WatertightRay(const Vec3 &o, const Vec3 &d) : org(o)
+		{
+			double ad[3] = { std::abs(d.x), std::abs(d.y), std::abs(d.z) }, dd[3] = { d.x, d.y, d.z };
+			kz = (ad[0] > ad[1]) ? (ad[0] > ad[2] ? 0 : 2) : (ad[1] > ad[2] ? 1 : 2);
+			kx = (kz + 1) % 3; ky = (kx + 1) % 3;
+			if (dd[kz] < 0) std::swap(kx, ky);		//Keep the winding
+			sx = dd[kx] / dd[kz]; sy = dd[ky] / dd[kz]; sz = 1.0 / dd[kz];
+		}
+
+		static double Get(const Vec3 &v, int k) { return k == 0 ? v.x : (k == 1 ? v.y : v.z); }
+
+		bool Intersect(const Vec3 &v0, const Vec3 &v1, const Vec3 &v2, double &tMax) const
+		{
+			Vec3 a = v0 - org, b = v1 - org, c = v2 - org;
+			double	ax = Get(a, kx) - sx*Get(a, kz), ay = Get(a, ky) - sy*Get(a, kz),
+					bx = Get(b, kx) - sx*Get(b, kz), by = Get(b, ky) - sy*Get(b, kz),
+					cx = Get(c, kx) - sx*Get(c, kz), cy = Get(c, ky) - sy*Get(c, kz);
+
+			double	u = cx*by - cy*bx,
+					v = ax*cy - ay*cx,
+					w = bx*ay - by*ax;
+			if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+			double det = u + v + w;
+			if (det == 0) return false;
+
+			double t = (u*sz*Get(a, kz) + v*sz*Get(b, kz) + w*sz*Get(c, kz)) / det;
+			if (t <= 0 || t >= tMax) return false;
+			tMax = t;
+			return true;
+		}
+	};
+};
+
+
+/*----OBJ loading----*/
+
+// Load the vertices and faces of a Wavefront OBJ file. Polygons are fan-triangulated and
+// everything but 'v' and 'f' lines is ignored. Builds the BVH. Returns 0 on success, 1 on
+// error, with the line number and reason in *error if given
+inline int LoadOBJ(const std::string &filename, TriangleMesh &mesh, std::string *error = nullptr)
+{
+	auto fail = [&](size_t line, const std::string &why)
+	{
+		if (error) *error = filename + (line ? ":" + std::to_string(line) : std::string()) + ": " + why;
+		return 1;
+	};
+
+	std::string buffer;
+	if (ReadWholeFile(filename, buffer)) return fail(0, "cannot read file");
+	mesh.vertices.clear(); mesh.indices.clear();
+
+	const char *p = buffer.data(), *end = p + buffer.size();
+	auto skipSpace = [&]() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++; };
+	std::vector<uint32_t> face;
+	size_t line = 0;
+
+	while (p < end)
+	{
+		line++;
+		const char *eol = p;
+		while (eol < end && *eol != '\n') eol++;
+
+		skipSpace();
+		if (p + 1 < eol && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p += 1;
+			double xyz[3];
+			for (int k = 0; k < 3; k++)
+			{
+				skipSpace();
+				if (p < eol && *p == '+') p++;
+				std::from_chars_result r = std::from_chars(p, eol, xyz[k]);
+				if (r.ec != std::errc()) return fail(line, "expected three vertex coordinates");
+				p = r.ptr;
+			}
+			mesh.vertices.push_back({ float(xyz[0]), float(xyz[1]), float(xyz[2]) });
+		}
+		else if (p + 1 < eol && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p += 1;
+			face.clear();
+			while (true)
+			{
+				skipSpace();
+				if (p >= eol) break;
+
+				long long index;
+				std::from_chars_result r = std::from_chars(p, eol, index);
+				if (r.ec != std::errc()) return fail(line, "bad face index");
+				p = r.ptr;
+				while (p < eol && *p != ' ' && *p != '\t' && *p != '\r') p++;	//Skip /vt/vn
+
+				if (index < 0) index += (long long)mesh.vertices.size() + 1;	//Relative to the last vertex
+				if (index < 1 || index > (long long)mesh.vertices.size())
+					return fail(line, "face index out of range");
+				face.push_back(uint32_t(index - 1));
+			}
+			if (face.size() < 3) return fail(line, "face with fewer than three vertices");
+
+			for (size_t k = 1; k + 1 < face.size(); k++)
+			{
+				mesh.indices.push_back(face[0]);
+				mesh.indices.push_back(face[k]);
+				mesh.indices.push_back(face[k + 1]);
+			}
+		}
+		p = eol + (eol < end ? 1 : 0);
+	}
+
+	mesh.BuildBVH();
+	return 0;
+}
+
+#endif
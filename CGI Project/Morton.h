@@ -0,0 +1,79 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Z-order (Morton) curve helpers. Interleaving the bits of x and y keeps pixels that are
+// close in 2D close in the 1D order, for tile layouts and cache-friendly traversal.
+
+// Spread the low 16 bits of v to the even bit positions
+inline uint32_t MortonSpread(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Inverse of MortonSpread
+inline uint32_t MortonCompact(uint32_t v)
+{
+	v &= 0x55555555;
+	v = (v | (v >> 1)) & 0x33333333;
+	v = (v | (v >> 2)) & 0x0f0f0f0f;
+	v = (v | (v >> 4)) & 0x00ff00ff;
+	v = (v | (v >> 8)) & 0x0000ffff;
+	return v;
+}
+
+inline uint32_t MortonEncode(uint32_t x, uint32_t y) { return MortonSpread(x) | (MortonSpread(y) << 1); }
+inline void MortonDecode(uint32_t code, int &x, int &y) { x = int(MortonCompact(code)); y = int(MortonCompact(code >> 1)); }
+
+struct TileRect
+{
+	int x0, y0, x1, y1;		//Half-open pixel bounds [x0, x1) x [y0, y1)
+};
+
+// Tiles of tileSize covering a width x height frame, sorted along the Z-order curve.
+// Edge tiles are clipped to the frame
+inline std::vector<TileRect> MortonTiles(int width, int height, int tileSize)
+{
+	int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+	std::vector<uint32_t> codes;
+	codes.reserve(size_t(tilesX)*tilesY);
+	for (int ty = 0; ty < tilesY; ty++)
+		for (int tx = 0; tx < tilesX; tx++)
+			codes.push_back(MortonEncode(tx, ty));
+	std::sort(codes.begin(), codes.end());
+
+	std::vector<TileRect> tiles;
+	tiles.reserve(codes.size());
+	for (uint32_t code : codes)
+	{
+		int tx, ty;
+		MortonDecode(code, tx, ty);
+		tiles.push_back({ tx*tileSize, ty*tileSize, std::min(width, (tx + 1)*tileSize), std::min(height, (ty + 1)*tileSize) });
+	}
+	return tiles;
+}
+
+// Call fn(x, y) for every pixel of the rectangle in Z-order
+template<class Fn>
+void ForEachPixelMorton(const TileRect &r, Fn fn)
+{
+	int w = r.x1 - r.x0, h = r.y1 - r.y0, side = 1;
+	while (side < std::max(w, h)) side <<= 1;
+
+	for (uint32_t code = 0, n = uint32_t(side)*side; code < n; code++)
+	{
+		int x, y;
+		MortonDecode(code, x, y);
+		if (x < w && y < h) fn(r.x0 + x, r.y0 + y);
+	}
+}
+
+#endif
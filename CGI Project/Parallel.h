@@ -0,0 +1,57 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Number of worker threads used by ParallelFor. 0 picks the hardware thread count
+inline int &WorkerThreads()
+{
+	static int n = 0;
+	return n;
+}
+
+inline int ThreadCount()
+{
+	int n = WorkerThreads();
+	if (n <= 0) n = int(std::thread::hardware_concurrency());
+	return std::max(n, 1);
+}
+
+// Splits [begin, end) into blocks of 'grain' indices and hands them out to worker
+// threads on demand. body(lo, hi) is called once per block; blocks never overlap.
+template<class Body>
+void ParallelFor(int begin, int end, int grain, Body body)
+{
+	if (end <= begin) return;
+	grain = std::max(grain, 1);
+
+	int nBlocks = (end - begin + grain - 1) / grain,
+		nThreads = std::min(ThreadCount(), nBlocks);
+
+	if (nThreads <= 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	auto worker = [&]()
+	{
+		int block;
+		while ((block = next.fetch_add(1)) < nBlocks)
+		{
+			int lo = begin + block * grain;
+			body(lo, std::min(lo + grain, end));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nThreads; t++) threads.emplace_back(worker);
+	worker();
+	for (auto &t : threads) t.join();
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/*----Hardware performance counters----*/
+//Linux perf_event_open counters for this process, its threads included (ParallelFor
+//workers are started after the counters open, so inherit picks them up). User space
+//only, which perf_event_paranoid up to 2 allows. Each counter is opened on its own, so
+//one the CPU or a virtual machine lacks leaves the rest working; a counter that cannot
+//be opened reads as unavailable, with the reason in Error(), and callers carry on with
+//wall time alone. Elsewhere than Linux nothing is available. When the kernel has to
+//share the hardware between more counters than it has, counts are scaled up by the
+//fraction of the time each was running.
+
+enum PerfCounter { PERF_TASK_CLOCK, PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_COUNTERS };
+
+const char *const PerfCounterNames[PERF_COUNTERS] = { "task_clock_ns", "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+
+struct PerfReading
+{
+	double value[PERF_COUNTERS] = {};
+	bool valid[PERF_COUNTERS] = {};
+
+	double Ratio(PerfCounter a, PerfCounter b) const		//a/b, or a negative value if either is unavailable
+	{
+		return valid[a] && valid[b] && value[b] > 0 ? value[a] / value[b] : -1.0;
+	}
+};
+
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+#ifdef __linux__
+		struct Config { uint32_t type; uint64_t config; };
+		const uint64_t cacheMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const Config configs[PERF_COUNTERS] = {
+			{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cacheMiss },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cacheMiss },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		};
+
+		for (int i = 0; i < PERF_COUNTERS; i++)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = configs[i].type;
+			attr.config = configs[i].config;
+			attr.disabled = 1;
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			fd[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			if (fd[i] < 0 && error.empty())
+				error = std::string("perf_event_open failed for ") + PerfCounterNames[i] + ": " + std::strerror(errno)
+					  + (errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+		}
+#else
+		error = "performance counters are only read on Linux";
+#endif
+	}
+
+	~PerfCounters()
+	{
+#ifdef __linux__
+		for (int f : fd) if (f >= 0) close(f);
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters &operator=(const PerfCounters&) = delete;
+
+	bool Available(PerfCounter c) const { return fd[c] >= 0; }
+	bool AnyHardware() const
+	{
+		for (int i = PERF_CYCLES; i < PERF_COUNTERS; i++) if (fd[i] >= 0) return true;
+		return false;
+	}
+	const std::string &Error() const { return error; }	//Why the first unavailable counter failed, empty if none did
+
+	// Zero the counters and start counting
+	void Start()
+	{
+#ifdef __linux__
+		for (int f : fd)
+			if (f >= 0) { ioctl(f, PERF_EVENT_IOC_RESET, 0); ioctl(f, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+	}
+
+	// Stop counting and read the counts since Start
+	PerfReading Stop()
+	{
+		PerfReading r;
+#ifdef __linux__
+		for (int i = 0; i < PERF_COUNTERS; i++)
+		{
+			if (fd[i] < 0) continue;
+			ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+			uint64_t data[3];		//Value, time enabled, time running
+			if (read(fd[i], data, sizeof(data)) != ssize_t(sizeof(data)) || data[2] == 0) continue;
+			r.value[i] = double(data[0]) * (double(data[1]) / double(data[2]));
+			r.valid[i] = true;
+		}
+#endif
+		return r;
+	}
+
+private:
+	int fd[PERF_COUNTERS] = { -1, -1, -1, -1, -1, -1 };
+	std::string error;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <cstdint>
+#include <cstring>
+#include "Vec3.h"
+
+// Framebuffer pixel storage types. Rendering always works in Vec3 (double); these only
+// decide how a pixel is held in memory. Conversion happens in PixelTraits when a
+// pixel is written (Set/Accumulate) and when it is read back or saved. Vec3f lives in Vec3.h.
+
+
+/*----Half precision----*/
+
+inline uint16_t FloatToHalf(float f)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &f, 4);
+
+	uint32_t sign = (bits >> 16) & 0x8000,
+			 mant = bits & 0x7fffff;
+	int		 exp = int((bits >> 23) & 0xff) - 127 + 15;
+
+	if (exp >= 31)		//Overflow, inf and NaN
+	{
+		if (((bits >> 23) & 0xff) == 0xff && mant) return uint16_t(sign | 0x7e00);
+		return uint16_t(sign | 0x7c00);
+	}
+	if (exp <= 0)		//Subnormal half or zero
+	{
+		if (exp < -10) return uint16_t(sign);
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32_t half = mant >> shift, rest = mant & ((1u << shift) - 1), mid = 1u << (shift - 1);
+		if (rest > mid || (rest == mid && (half & 1))) half++;		//Round to nearest even
+		return uint16_t(sign | half);
+	}
+
+	uint32_t half = sign | (uint32_t(exp) << 10) | (mant >> 13), rest = mant & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;	//Carry into the exponent is correct
+	return uint16_t(half);
+}
+
+inline float HalfToFloat(uint16_t h)
+{
+	uint32_t sign = uint32_t(h & 0x8000) << 16,
+			 exp = (h >> 10) & 0x1f,
+			 mant = h & 0x3ff,
+			 bits;
+
+	if (exp == 0)
+	{
+		if (mant == 0) bits = sign;
+		else			//Subnormal: normalise into a float
+		{
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400)) { mant <<= 1; exp--; }
+			bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+	}
+	else if (exp == 31) bits = sign | 0x7f800000 | (mant << 13);
+	else bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+	float f;
+	std::memcpy(&f, &bits, 4);
+	return f;
+}
+
+struct Half3
+{
+	uint16_t x, y, z;
+};
+
+
+/*----Conversions----*/
+
+template<class Pixel> struct PixelTraits;
+
+template<> struct PixelTraits<Vec3>
+{
+	static Vec3 Load(const Vec3 &p) { return p; }
+	static Vec3 Store(const Vec3 &v) { return v; }
+	static void ToFloat(const Vec3 &p, float *rgb) { rgb[0] = float(p.x); rgb[1] = float(p.y); rgb[2] = float(p.z); }
+};
+
+template<> struct PixelTraits<Vec3f>
+{
+	static Vec3 Load(const Vec3f &p) { return Vec3(p.x, p.y, p.z); }
+	static Vec3f Store(const Vec3 &v) { return { float(v.x), float(v.y), float(v.z) }; }
+	static void ToFloat(const Vec3f &p, float *rgb) { rgb[0] = p.x; rgb[1] = p.y; rgb[2] = p.z; }
+};
+
+template<> struct PixelTraits<Half3>
+{
+	static Vec3 Load(const Half3 &p) { return Vec3(HalfToFloat(p.x), HalfToFloat(p.y), HalfToFloat(p.z)); }
+	static Half3 Store(const Vec3 &v) { return { FloatToHalf(float(v.x)), FloatToHalf(float(v.y)), FloatToHalf(float(v.z)) }; }
+	static void ToFloat(const Half3 &p, float *rgb) { rgb[0] = HalfToFloat(p.x); rgb[1] = HalfToFloat(p.y); rgb[2] = HalfToFloat(p.z); }
+};
+
+#endif
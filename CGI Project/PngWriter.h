@@ -0,0 +1,486 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Parallel.h"
+#include "Trace.h"
+
+
+/*----Deflate----*/
+//LZ77 with hash chains and the fixed Huffman code, as in stb_image_write, but able to
+//compress a stream piece by piece. Every Compress call ends in a sync flush (an empty
+//stored block), so its output is byte-aligned and can be followed by any other piece.
+
+class Deflater
+{
+public:
+	// level is the number of hash chain entries probed per byte, like stb's "quality"
+	explicit Deflater(int level = 8) : level(std::max(level, 1)), head(HashSize), prev(WindowSize) {}
+
+	void Compress(const unsigned char *data, size_t len, std::vector<unsigned char> &out)
+	{
+		const Tables &t = GetTables();
+		bitbuf = 0; bitcount = 0;
+		std::fill(head.begin(), head.end(), -1);
+
+		out.reserve(out.size() + len + len / 8 + 16);	//Worst case, all 9-bit literals
+		AddBits(0, 1);	//BFINAL = 0
+		AddBits(1, 2);	//BTYPE = 1, fixed Huffman
+
+		long i = 0, n = long(len);
+		while (i + MinMatch <= n)
+		{
+			long dist = 0;
+			int best = LongestMatch(data, i, n, dist);
+
+			//Lazy matching: emit a literal if the next byte starts a longer match
+			if (best && level > 1 && i + 1 + MinMatch <= n)
+			{
+				Insert(data, i);
+				long nextDist;
+				if (LongestMatch(data, i + 1, n, nextDist) > best)
+				{
+					Literal(data[i++], t, out);
+					continue;
+				}
+				for (long k = 1; k < best && i + k + MinMatch <= n; k++) Insert(data, i + k);
+			}
+			else
+			{
+				//At the fast level only the start of long matches is hashed
+				long hashed = (best > 32 && level == 1) ? 1 : std::max(best, 1);
+				for (long k = 0; k < hashed && i + k + MinMatch <= n; k++) Insert(data, i + k);
+			}
+
+			if (best)
+			{
+				Match(best, int(dist), t, out);
+				i += best;
+			}
+			else Literal(data[i++], t, out);
+		}
+		for (; i < n; i++) Literal(data[i], t, out);
+
+		Symbol(256, t, out);	//End of block
+		AddBits(0, 3);			//Empty stored block: BFINAL = 0, BTYPE = 0...
+		Flush(out, true);		//...padded to a byte boundary...
+		out.push_back(0x00); out.push_back(0x00); out.push_back(0xFF); out.push_back(0xFF);	//...LEN = 0, NLEN = ~0
+	}
+
+	// Empty final block closing the deflate stream
+	static void Finish(std::vector<unsigned char> &out)
+	{
+		out.push_back(0x03);
+		out.push_back(0x00);
+	}
+
+private:
+	static const int	MinMatch = 3, MaxMatch = 258,
+						WindowSize = 32768, HashBits = 15, HashSize = 1 << HashBits;
+
+	struct Tables
+	{
+		unsigned short	code[288];		//Fixed Huffman codes, bit-reversed for LSB-first output
+		unsigned char	codeLen[288];
+		unsigned char	lengthSym[MaxMatch + 1], distSymLo[256], distSymHi[256];
+		unsigned short	lengthBase[29], distBase[30];
+		unsigned char	lengthExtra[29], distExtra[30];
+	};
+
+	int level;
+	std::vector<int> head, prev;
+	uint64_t bitbuf = 0;
+	int bitcount = 0;
+
+	static const Tables &GetTables()
+	{
+		static const Tables t = BuildTables();
+		return t;
+	}
+
+	static Tables BuildTables()
+	{
+		static const unsigned short	lbase[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 },
+									dbase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+		static const unsigned char	lextra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 },
+									dextra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+		Tables t;
+
+		for (int s = 0; s < 288; s++)
+		{
+			int c, len;
+			if (s <= 143)		{ c = 0x30 + s;			len = 8; }
+			else if (s <= 255)	{ c = 0x190 + s - 144;	len = 9; }
+			else if (s <= 279)	{ c = s - 256;			len = 7; }
+			else				{ c = 0xC0 + s - 280;	len = 8; }
+			t.code[s] = (unsigned short)Reverse(c, len);
+			t.codeLen[s] = (unsigned char)len;
+		}
+
+		std::memcpy(t.lengthBase, lbase, sizeof(lbase)); std::memcpy(t.lengthExtra, lextra, sizeof(lextra));
+		std::memcpy(t.distBase, dbase, sizeof(dbase)); std::memcpy(t.distExtra, dextra, sizeof(dextra));
+
+		for (int l = MinMatch, s = 0; l <= MaxMatch; l++)
+		{
+			while (s < 28 && l >= lbase[s + 1]) s++;
+			t.lengthSym[l] = (unsigned char)s;
+		}
+		//Distances up to 256 index distSymLo directly, larger ones by (d - 1) >> 7
+		for (int d = 1, s = 0; d <= 256; d++)
+		{
+			while (s < 29 && d >= dbase[s + 1]) s++;
+			t.distSymLo[d - 1] = (unsigned char)s;
+		}
+		for (int k = 2, s = 0; k < 256; k++)
+		{
+			int d = (k << 7) + 1;
+			while (s < 29 && d >= dbase[s + 1]) s++;
+			t.distSymHi[k] = (unsigned char)s;
+		}
+		return t;
+	}
+
+	static int Reverse(int code, int bits)
+	{
+		int r = 0;
+		while (bits--) { r = (r << 1) | (code & 1); code >>= 1; }
+		return r;
+	}
+
+	static unsigned Hash(const unsigned char *p)
+	{
+		return ((unsigned(p[0]) << 16 | unsigned(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - HashBits);
+	}
+
+	void Insert(const unsigned char *data, long pos)
+	{
+		unsigned h = Hash(data + pos);
+		prev[pos & (WindowSize - 1)] = head[h];
+		head[h] = int(pos);
+	}
+
+	// Length of the longest match for data[pos..] within the window, 0 if shorter than MinMatch
+	int LongestMatch(const unsigned char *data, long pos, long n, long &dist) const
+	{
+		int best = 0, limit = int(std::min<long>(MaxMatch, n - pos)), chain = level;
+		long cand = head[Hash(data + pos)];
+
+		while (cand >= 0 && pos - cand <= WindowSize && chain-- > 0)
+		{
+			if (data[cand + best] == data[pos + best])
+			{
+				int l = 0;
+				while (l < limit && data[cand + l] == data[pos + l]) l++;
+				if (l > best)
+				{
+					best = l; dist = pos - cand;
+					if (l == limit) break;
+				}
+			}
+			long next = prev[cand & (WindowSize - 1)];
+			if (next >= cand) break;	//Slot reused by a newer position, chain ends here
+			cand = next;
+		}
+		return best >= MinMatch ? best : 0;
+	}
+
+	void AddBits(unsigned value, int bits)
+	{
+		bitbuf |= uint64_t(value) << bitcount;
+		bitcount += bits;
+	}
+
+	// Bytes are only moved out once 32 bits are pending; codes are at most 31 bits wide
+	void Flush(std::vector<unsigned char> &out, bool pad = false)
+	{
+		if (bitcount < 32 && !pad) return;
+		while (bitcount >= 8)
+		{
+			out.push_back((unsigned char)bitbuf);
+			bitbuf >>= 8; bitcount -= 8;
+		}
+		if (pad && bitcount > 0)
+		{
+			out.push_back((unsigned char)bitbuf);
+			bitbuf = 0; bitcount = 0;
+		}
+	}
+
+	void Symbol(int s, const Tables &t, std::vector<unsigned char> &out)
+	{
+		AddBits(t.code[s], t.codeLen[s]);
+		Flush(out);
+	}
+
+	void Literal(unsigned char c, const Tables &t, std::vector<unsigned char> &out) { Symbol(c, t, out); }
+
+	void Match(int len, int dist, const Tables &t, std::vector<unsigned char> &out)
+	{
+		int ls = t.lengthSym[len],
+			ds = dist <= 256 ? t.distSymLo[dist - 1] : t.distSymHi[(dist - 1) >> 7];
+
+		AddBits(t.code[257 + ls], t.codeLen[257 + ls]);
+		AddBits(len - t.lengthBase[ls], t.lengthExtra[ls]);
+		AddBits(Reverse(ds, 5), 5);
+		AddBits(dist - t.distBase[ds], t.distExtra[ds]);
+		Flush(out);
+	}
+};
+
+
+/*----PNG writer----*/
+//Writes an 8-bit PNG a strip of rows at a time. Each strip is filtered, deflated and written
+//out as its own IDAT chunk, so nothing but the previous row is kept between calls.
+//Large strips are cut into row ranges that are deflated independently on worker threads
+//and concatenated, which works because every Deflater piece ends byte-aligned (as in pigz).
+
+class PngWriter
+{
+public:
+	static const int	Fast = 1,		//One hash probe per byte, no lazy matching, Paeth filter on every row
+						Default = 8,
+						Small = 32;
+
+	explicit PngWriter(int level = Default) : level(level) {}
+	~PngWriter() { if (file.is_open()) Close(); }
+
+	bool Open(const std::string &filename, int w, int h, int channels = 3)
+	{
+		static const unsigned char sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		static const int colourType[5] = { -1, 0, 4, 2, 6 };
+
+		width = w; height = h; comp = channels; rowsWritten = 0;
+		adler = 1;
+		prevRow.assign(size_t(width)*comp, 0);
+
+		file.open(filename, std::ios::binary);
+		if (!file.is_open()) return false;
+		file.write((const char*)sig, 8);
+
+		std::vector<unsigned char> ihdr;
+		Put32(ihdr, width); Put32(ihdr, height);
+		ihdr.push_back(8);							//Bit depth
+		ihdr.push_back((unsigned char)colourType[comp]);
+		ihdr.push_back(0); ihdr.push_back(0); ihdr.push_back(0);	//Deflate, adaptive filtering, no interlace
+		WriteChunk("IHDR", ihdr);
+
+		zlib.clear();
+		zlib.push_back(0x78); zlib.push_back(0x5e);	//Deflate, 32K window
+		return bool(file);
+	}
+
+	// Append nRows tightly packed rows of width*channels bytes
+	bool WriteRows(const unsigned char *rows, int nRows)
+	{
+		if (!file.is_open() || nRows <= 0 || rowsWritten + nRows > height) return false;
+
+		size_t stride = size_t(width)*comp, filteredStride = stride + 1;
+		std::vector<unsigned char> filtered(filteredStride*nRows);
+		ParallelFor(0, nRows, 8, [&](int r0, int r1)
+		{
+			std::vector<unsigned char> line(stride);
+			for (int r = r0; r < r1; r++)
+			{
+				const unsigned char *row = rows + stride*r,
+									*above = r ? row - stride : prevRow.data();
+				FilterRow(row, above, rowsWritten + r == 0, &filtered[filteredStride*r], line);
+			}
+		});
+		std::memcpy(prevRow.data(), rows + stride*(nRows - 1), stride);
+
+		//Pieces of at least MinPieceBytes, so small strips do not lose compression to the split
+		int rowsPerPiece = std::max(int((MinPieceBytes + filteredStride - 1) / filteredStride),
+									(nRows + ThreadCount() - 1) / ThreadCount()),
+			nPieces = (nRows + rowsPerPiece - 1) / rowsPerPiece;
+		std::vector<std::vector<unsigned char> > pieces(nPieces);
+		std::vector<unsigned> pieceAdler(nPieces);
+
+		ParallelFor(0, nPieces, 1, [&](int p0, int p1)
+		{
+			TRACE_SCOPE("deflate");
+			Deflater deflater(level);
+			for (int p = p0; p < p1; p++)
+			{
+				int r0 = p*rowsPerPiece, r1 = std::min(nRows, r0 + rowsPerPiece);
+				const unsigned char *src = &filtered[filteredStride*r0];
+				size_t len = filteredStride*(r1 - r0);
+
+				pieceAdler[p] = Adler32(1, src, len);
+				deflater.Compress(src, len, pieces[p]);
+			}
+		});
+
+		for (int p = 0; p < nPieces; p++)
+		{
+			int r0 = p*rowsPerPiece, r1 = std::min(nRows, r0 + rowsPerPiece);
+			adler = AdlerCombine(adler, pieceAdler[p], filteredStride*(r1 - r0));
+			zlib.insert(zlib.end(), pieces[p].begin(), pieces[p].end());
+		}
+		WriteChunk("IDAT", zlib);
+		zlib.clear();
+
+		rowsWritten += nRows;
+		return bool(file);
+	}
+
+	// Finish the zlib stream and the file. Fails if fewer rows than the height were written
+	bool Close()
+	{
+		if (!file.is_open()) return false;
+		bool complete = rowsWritten == height;
+
+		Deflater::Finish(zlib);
+		Put32(zlib, adler);
+		WriteChunk("IDAT", zlib);
+		WriteChunk("IEND", std::vector<unsigned char>());
+
+		complete = complete && bool(file);
+		file.close();
+		return complete;
+	}
+
+private:
+	static const size_t MinPieceBytes = 128 * 1024;
+
+	std::ofstream file;
+	int level;
+	int width = 0, height = 0, comp = 3, rowsWritten = 0;
+	unsigned adler = 1;
+	std::vector<unsigned char> prevRow, zlib;
+
+	static void Put32(std::vector<unsigned char> &v, unsigned x)
+	{
+		v.push_back((unsigned char)(x >> 24)); v.push_back((unsigned char)(x >> 16));
+		v.push_back((unsigned char)(x >> 8)); v.push_back((unsigned char)x);
+	}
+
+	static unsigned Crc32(unsigned crc, const unsigned char *p, size_t len)
+	{
+		static const std::vector<unsigned> table = []()
+		{
+			std::vector<unsigned> t(256);
+			for (unsigned n = 0; n < 256; n++)
+			{
+				unsigned c = n;
+				for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < len; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	void WriteChunk(const char *tag, const std::vector<unsigned char> &payload)
+	{
+		std::vector<unsigned char> header;
+		Put32(header, unsigned(payload.size()));
+		header.insert(header.end(), tag, tag + 4);
+
+		unsigned crc = Crc32(0, header.data() + 4, 4);
+		if (!payload.empty()) crc = Crc32(crc, payload.data(), payload.size());
+
+		std::vector<unsigned char> trailer;
+		Put32(trailer, crc);
+		file.write((const char*)header.data(), header.size());
+		if (!payload.empty()) file.write((const char*)payload.data(), payload.size());
+		file.write((const char*)trailer.data(), trailer.size());
+	}
+
+	static unsigned Adler32(unsigned adler, const unsigned char *p, size_t len)
+	{
+		unsigned a = adler & 0xffff, b = adler >> 16;
+		while (len > 0)
+		{
+			size_t block = std::min<size_t>(len, 5552);		//Largest run before the sums can overflow
+			for (size_t i = 0; i < block; i++) { a += p[i]; b += a; }
+			a %= 65521; b %= 65521;
+			p += block; len -= block;
+		}
+		return (b << 16) | a;
+	}
+
+	// Adler-32 of A followed by B, from the checksums of each and the length of B (zlib's adler32_combine)
+	static unsigned AdlerCombine(unsigned adlerA, unsigned adlerB, size_t lenB)
+	{
+		const unsigned Base = 65521;
+		unsigned rem = unsigned(lenB % Base),
+				 sum1 = adlerA & 0xffff,
+				 sum2 = unsigned((uint64_t(rem) * sum1) % Base);
+
+		sum1 += (adlerB & 0xffff) + Base - 1;
+		sum2 += (adlerA >> 16) + (adlerB >> 16) + Base - rem;
+		if (sum1 >= Base) sum1 -= Base;
+		if (sum1 >= Base) sum1 -= Base;
+		if (sum2 >= 2*Base) sum2 -= 2*Base;
+		if (sum2 >= Base) sum2 -= Base;
+		return (sum2 << 16) | sum1;
+	}
+
+	static unsigned char Paeth(int a, int b, int c)
+	{
+		int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		if (pa <= pb && pa <= pc) return (unsigned char)a;
+		if (pb <= pc) return (unsigned char)b;
+		return (unsigned char)c;
+	}
+
+	// Pick the filter with the smallest sum of absolute residuals, the same heuristic as stb.
+	// The fast level skips the search and always uses Paeth
+	void FilterRow(const unsigned char *z, const unsigned char *up, bool firstRow, unsigned char *out,
+				   std::vector<unsigned char> &line) const
+	{
+		int stride = width*comp, bestType = 4;
+		long bestEst = -1;
+
+		for (int type = 0; type < 5 && level > Fast; type++)
+		{
+			if (firstRow && (type == 2 || type == 4)) continue;	//Up and Paeth equal None and Sub against a zero row
+			FilterWith(type, z, up, line.data());
+
+			long est = 0;
+			for (int i = 0; i < stride; i++) est += std::abs((signed char)line[i]);
+			if (bestEst < 0 || est < bestEst) { bestEst = est; bestType = type; }
+		}
+
+		out[0] = (unsigned char)bestType;
+		FilterWith(bestType, z, up, out + 1);
+	}
+
+	// One loop per filter type, with the first pixel (no left neighbour) peeled off
+	void FilterWith(int type, const unsigned char *z, const unsigned char *up, unsigned char *out) const
+	{
+		int stride = width*comp, n = std::min(comp, stride), i;
+		switch (type)
+		{
+		case 0:
+			std::memcpy(out, z, stride);
+			break;
+		case 1:
+			for (i = 0; i < n; i++) out[i] = z[i];
+			for (; i < stride; i++) out[i] = (unsigned char)(z[i] - z[i - n]);
+			break;
+		case 2:
+			for (i = 0; i < stride; i++) out[i] = (unsigned char)(z[i] - up[i]);
+			break;
+		case 3:
+			for (i = 0; i < n; i++) out[i] = (unsigned char)(z[i] - (up[i] >> 1));
+			for (; i < stride; i++) out[i] = (unsigned char)(z[i] - ((z[i - n] + up[i]) >> 1));
+			break;
+		case 4:
+			for (i = 0; i < n; i++) out[i] = (unsigned char)(z[i] - up[i]);
+			for (; i < stride; i++) out[i] = (unsigned char)(z[i] - Paeth(z[i - n], up[i], up[i - n]));
+			break;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "Arena.h"
+#include "BVH.h"
+#include "Instance.h"
+#include "Mesh.h"
+#include "Stats.h"
+#include "Vec3.h"
+
+
+/*----Primitive data----*/
+//Hot geometry only. Materials are kept in a separate array and referenced by index,
+//so the intersection loops touch nothing but geometry.
+
+enum PrimitiveType { PRIM_SPHERE, PRIM_BOX, PRIM_QUAD, PRIM_PLANE, PRIM_MESH, PRIM_INSTANCES, PRIM_TYPES };
+
+struct SphereGeom
+{
+	Vec3 centre;
+	double rad;
+};
+
+struct BoxGeom		//Axis-aligned
+{
+	Vec3 centre, half;
+};
+
+struct QuadGeom		//Parallelogram spanned by u and v from corner
+{
+	Vec3 corner, u, v, normal,
+		 w;			//cross(u, v) / |cross(u, v)|^2, turns a point into (u, v) coordinates
+};
+
+struct PlaneGeom
+{
+	Vec3 point, normal;
+};
+
+struct MeshGeom
+{
+	const TriangleMesh *mesh;
+};
+
+struct InstancesGeom
+{
+	const InstanceSet *set;
+};
+
+struct Material
+{
+	Vec3 col;		//RGB 0-1
+	Vec3 emit;
+};
+
+struct Hit
+{
+	double t = INFINITY;
+	Vec3 pos, normal;
+	int material = -1;
+};
+
+
+/*----Intersection----*/
+//One overload per primitive type. Each returns true and shortens tMax on a hit closer than
+//tMax, and writes the surface normal. Rays starting inside a closed primitive hit its far side.
+
+inline bool IntersectPrimitive(const SphereGeom &s, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	Vec3 oc = org - s.centre;
+	double	a = dir.norm2(),
+			b = 2 * dot(dir, oc),
+			c = oc.norm2() - s.rad*s.rad,
+			det = b * b - 4 * a*c;
+	if (det < 0) return false;
+
+	double	root = std::sqrt(det),
+			t = (-b - root) / (2 * a);
+	if (t <= 0) t = (-b + root) / (2 * a);
+	if (t <= 0 || t >= tMax) return false;
+
+	tMax = t;
+	normal = (oc + dir*t) / s.rad;
+	return true;
+}
+
+inline bool IntersectPrimitive(const BoxGeom &bx, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	const double	o[3] = { org.x - bx.centre.x, org.y - bx.centre.y, org.z - bx.centre.z },
+					d[3] = { dir.x, dir.y, dir.z },
+					h[3] = { bx.half.x, bx.half.y, bx.half.z };
+	double	tNear = -INFINITY, tFar = INFINITY;
+	int		axisNear = 0, axisFar = 0;
+
+	for (int i = 0; i < 3; i++)		//Slab test
+	{
+		if (d[i] == 0.0)
+		{
+			if (std::abs(o[i]) > h[i]) return false;
+			continue;
+		}
+		double	t1 = (-h[i] - o[i]) / d[i],
+				t2 = (h[i] - o[i]) / d[i];
+		if (t1 > t2) std::swap(t1, t2);
+		if (t1 > tNear) { tNear = t1; axisNear = i; }
+		if (t2 < tFar) { tFar = t2; axisFar = i; }
+	}
+	if (tNear > tFar || tFar <= 0) return false;
+
+	int axis = (tNear > 0) ? axisNear : axisFar;
+	double t = (tNear > 0) ? tNear : tFar;
+	if (t >= tMax) return false;
+
+	double n[3] = { 0.0, 0.0, 0.0 };
+	n[axis] = (o[axis] + t*d[axis] > 0) ? 1.0 : -1.0;
+	tMax = t;
+	normal = { n[0], n[1], n[2] };
+	return true;
+}
+
+inline bool IntersectPrimitive(const QuadGeom &q, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	double denom = dot(q.normal, dir);
+	if (std::abs(denom) < 1e-12) return false;		//Parallel to the quad
+
+	double t = dot(q.normal, q.corner - org) / denom;
+	if (t <= 0 || t >= tMax) return false;
+
+	Vec3	p = org + dir*t - q.corner;
+	double	alpha = dot(q.w, cross(p, q.v)),
+			beta = dot(q.w, cross(q.u, p));
+	if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1) return false;
+
+	tMax = t;
+	normal = q.normal;
+	return true;
+}
+
+inline bool IntersectPrimitive(const PlaneGeom &pl, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	double denom = dot(pl.normal, dir);
+	if (std::abs(denom) < 1e-12) return false;
+
+	double t = dot(pl.normal, pl.point - org) / denom;
+	if (t <= 0 || t >= tMax) return false;
+
+	tMax = t;
+	normal = pl.normal;
+	return true;
+}
+
+inline bool IntersectPrimitive(const MeshGeom &m, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	return m.mesh->Intersect(org, dir, tMax, normal);
+}
+
+inline bool IntersectPrimitive(const InstancesGeom &i, const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal)
+{
+	return i.set->Intersect(org, dir, tMax, normal);
+}
+
+inline AABB PrimitiveBounds(const SphereGeom &s)
+{
+	AABB b;
+	b.Grow(s.centre - Vec3(s.rad, s.rad, s.rad));
+	b.Grow(s.centre + Vec3(s.rad, s.rad, s.rad));
+	return b;
+}
+
+inline AABB PrimitiveBounds(const BoxGeom &bx)
+{
+	AABB b;
+	b.Grow(bx.centre - bx.half);
+	b.Grow(bx.centre + bx.half);
+	return b;
+}
+
+inline AABB PrimitiveBounds(const QuadGeom &q)
+{
+	AABB b;
+	b.Grow(q.corner); b.Grow(q.corner + q.u); b.Grow(q.corner + q.v); b.Grow(q.corner + q.u + q.v);
+	return b;
+}
+
+inline AABB PrimitiveBounds(const MeshGeom &m) { return m.mesh->Bounds(); }
+inline AABB PrimitiveBounds(const InstancesGeom &i) { return i.set->tlas.Bounds(); }
+
+
+/*----Scene----*/
+//Primitives are stored by type in contiguous arrays (structure of arrays), each with a
+//parallel array of material indices. Bounded types get their own BVH and are reordered
+//into its leaf order; planes are unbounded and are tested in a plain loop. Intersection
+//is a fixed sequence of per-type loops, with no virtual calls.
+//
+//Primitives are collected in ordinary vectors while the scene is described. Build()
+//moves them, the materials and the BVH nodes into the scene's arena, back to back,
+//and frees the vectors. Clear() empties the scene in one step and keeps the arena's
+//memory for the next one. Meshes and instance sets are referenced, not owned.
+//A scene loaded from a binary scene file instead points straight into the mapped file,
+//which the scene keeps open through backing.
+
+// built followed by pending, copied into the arena. pending is emptied
+template<class T>
+Span<T> ArenaAppend(Arena &arena, Span<T> built, std::vector<T> &pending)
+{
+	if (pending.empty()) return built;
+	pending.insert(pending.begin(), built.begin(), built.end());
+	Span<T> s = arena.Copy(pending);
+	std::vector<T>().swap(pending);
+	return s;
+}
+
+template<class Geom, bool Bounded = true>
+struct PrimitiveArray
+{
+	Span<Geom> geom;
+	Span<int> material;
+	Span<BVHNode> nodes;		//Empty when the primitives are tested in a loop
+
+	std::vector<Geom> pendingGeom;		//Added since the last Build()
+	std::vector<int> pendingMaterial;
+
+	static const size_t LinearLimit = 8;	//A tree only costs at this size
+
+	size_t Size() const { return geom.size + pendingGeom.size(); }
+
+	void Add(const Geom &g, int mat) { pendingGeom.push_back(g); pendingMaterial.push_back(mat); }
+
+	void Clear()
+	{
+		geom = Span<Geom>(); material = Span<int>(); nodes = Span<BVHNode>();
+		std::vector<Geom>().swap(pendingGeom); std::vector<int>().swap(pendingMaterial);
+	}
+
+	// Move everything added into the arena, building the BVH and sorting geometry and
+	// materials into leaf order. Arrays from an earlier build stay in the arena until it is reset
+	void Build(Arena &arena)
+	{
+		if (pendingGeom.empty()) return;
+		geom = ArenaAppend(arena, geom, pendingGeom);
+		material = ArenaAppend(arena, material, pendingMaterial);
+		nodes = Span<BVHNode>();
+
+		if constexpr (Bounded)
+		{
+			if (geom.size <= LinearLimit) return;
+
+			std::vector<AABB> bounds(geom.size);
+			for (size_t i = 0; i < geom.size; i++) bounds[i] = PrimitiveBounds(geom[i]);
+			BVH bvh;
+			bvh.Build(bounds);
+
+			std::vector<Geom> sortedGeom(geom.size);
+			std::vector<int> sortedMaterial(geom.size);
+			for (size_t i = 0; i < geom.size; i++)
+			{
+				sortedGeom[i] = geom[bvh.indices[i]];
+				sortedMaterial[i] = material[bvh.indices[i]];
+			}
+			std::copy(sortedGeom.begin(), sortedGeom.end(), geom.begin());
+			std::copy(sortedMaterial.begin(), sortedMaterial.end(), material.begin());
+			nodes = arena.Copy(bvh.nodes);
+		}
+	}
+
+	// Closest hit among this type. Returns the index hit, or -1
+	int Intersect(const Vec3 &org, const Vec3 &dir, double &tMax, Vec3 &normal) const
+	{
+		int hit = -1;
+		if (nodes.empty())
+		{
+			STAT_ADD(primitiveTests, geom.size);
+			for (size_t i = 0; i < geom.size; i++)
+				if (IntersectPrimitive(geom[i], org, dir, tMax, normal)) hit = int(i);
+			return hit;
+		}
+
+		BVH::Traverse(nodes.data, nodes.size, org, dir, tMax, [&](int first, int count, double &tClosest)
+		{
+			STAT_ADD(primitiveTests, count);
+			for (int i = first; i < first + count; i++)
+				if (IntersectPrimitive(geom[i], org, dir, tClosest, normal)) hit = i;
+		});
+		return hit;
+	}
+};
+
+class Scene
+{
+public:
+	Span<Material> materials;
+	PrimitiveArray<SphereGeom> spheres;
+	PrimitiveArray<BoxGeom> boxes;
+	PrimitiveArray<QuadGeom> quads;
+	PrimitiveArray<PlaneGeom, false> planes;
+	PrimitiveArray<MeshGeom> meshes;
+	PrimitiveArray<InstancesGeom> instances;
+	std::shared_ptr<const void> backing;		//Storage outside the arena that the arrays point into
+
+	int AddMaterial(const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })
+	{
+		pendingMaterials.push_back({ col, emit });
+		return int(materials.size + pendingMaterials.size()) - 1;
+	}
+
+	void AddSphere(const Vec3 &centre, double rad, int mat) { spheres.Add({ centre, rad }, mat); }
+
+	// Axis-aligned box from its centre and half-extents
+	void AddBox(const Vec3 &centre, const Vec3 &half, int mat) { boxes.Add({ centre, half }, mat); }
+
+	void AddQuad(const Vec3 &corner, const Vec3 &u, const Vec3 &v, int mat)
+	{
+		Vec3 n = cross(u, v), unit = n;
+		unit.normalise();
+		quads.Add({ corner, u, v, unit, n / n.norm2() }, mat);
+	}
+
+	void AddPlane(const Vec3 &point, Vec3 normal, int mat)
+	{
+		normal.normalise();
+		planes.Add({ point, normal }, mat);
+	}
+
+	void AddMesh(const TriangleMesh *mesh, int mat) { meshes.Add({ mesh }, mat); }
+	void AddInstances(const InstanceSet *set, int mat) { instances.Add({ set }, mat); }
+
+	// Colour and emission straight in, one new material per primitive
+	void AddSphere(const Vec3 &centre, double rad, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })	{ AddSphere(centre, rad, AddMaterial(col, emit)); }
+	void AddBox(const Vec3 &centre, const Vec3 &half, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })	{ AddBox(centre, half, AddMaterial(col, emit)); }
+	void AddQuad(const Vec3 &corner, const Vec3 &u, const Vec3 &v, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 }) { AddQuad(corner, u, v, AddMaterial(col, emit)); }
+	void AddPlane(const Vec3 &point, const Vec3 &normal, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })	{ AddPlane(point, normal, AddMaterial(col, emit)); }
+	void AddMesh(const TriangleMesh *mesh, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })			{ AddMesh(mesh, AddMaterial(col, emit)); }
+	void AddInstances(const InstanceSet *set, const Vec3 &col, const Vec3 &emit = { 0.0, 0.0, 0.0 })		{ AddInstances(set, AddMaterial(col, emit)); }
+
+	size_t Primitives() const
+	{
+		return spheres.Size() + boxes.Size() + quads.Size() + planes.Size() + meshes.Size() + instances.Size();
+	}
+
+	// Empty the scene. The arena keeps its memory, so refilling a scene of similar size allocates nothing
+	void Clear()
+	{
+		arena.Reset();
+		backing.reset();
+		materials = Span<Material>();
+		std::vector<Material>().swap(pendingMaterials);
+		spheres.Clear(); boxes.Clear(); quads.Clear(); planes.Clear(); meshes.Clear(); instances.Clear();
+	}
+
+	// Move the scene into the arena and build the BVHs. Must be called after adding primitives and before tracing
+	void Build()
+	{
+		materials = ArenaAppend(arena, materials, pendingMaterials);
+		spheres.Build(arena); boxes.Build(arena); quads.Build(arena); planes.Build(arena); meshes.Build(arena); instances.Build(arena);
+	}
+
+	size_t BytesUsed() const { return arena.BytesUsed(); }
+	size_t BytesReserved() const { return arena.Reserved(); }
+
+	// Closest surface along the ray. Read-only, so any number of threads can trace at once
+	bool Intersect(const Vec3 &org, const Vec3 &dir, Hit &hit) const
+	{
+		double t = hit.t;
+		Vec3 normal;
+		int type = -1, index = -1, i;
+
+		if ((i = spheres.Intersect(org, dir, t, normal)) >= 0)		{ type = PRIM_SPHERE; index = i; }
+		if ((i = boxes.Intersect(org, dir, t, normal)) >= 0)		{ type = PRIM_BOX; index = i; }
+		if ((i = quads.Intersect(org, dir, t, normal)) >= 0)		{ type = PRIM_QUAD; index = i; }
+		if ((i = planes.Intersect(org, dir, t, normal)) >= 0)		{ type = PRIM_PLANE; index = i; }
+		if ((i = meshes.Intersect(org, dir, t, normal)) >= 0)		{ type = PRIM_MESH; index = i; }
+		if ((i = instances.Intersect(org, dir, t, normal)) >= 0)	{ type = PRIM_INSTANCES; index = i; }
+		if (type < 0) return false;
+
+		hit.t = t;
+		hit.pos = org + dir*t;
+		hit.normal = normal;
+		hit.material = MaterialOf(PrimitiveType(type), index);
+		return true;
+	}
+
+private:
+	Arena arena;
+	std::vector<Material> pendingMaterials;
+
+	int MaterialOf(PrimitiveType type, int index) const
+	{
+		switch (type)
+		{
+		case PRIM_SPHERE:		return spheres.material[index];
+		case PRIM_BOX:			return boxes.material[index];
+		case PRIM_QUAD:			return quads.material[index];
+		case PRIM_PLANE:		return planes.material[index];
+		case PRIM_MESH:			return meshes.material[index];
+		case PRIM_INSTANCES:	return instances.material[index];
+		default:				return -1;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "file_loading.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "Vec3.h"
+
+
+/*----Text scene files----*/
+//One primitive per line, comma-separated, as in objects.txt. The first field is the
+//primitive type, colours are 0-255 and emission scales the colour:
+//
+//	0 sphere:	type, x, y, z, radius, r, g, b, emission
+//	1 box:		type, x, y, z, halfX, halfY, halfZ, r, g, b, emission
+//	2 quad:		type, cornerX, cornerY, cornerZ, uX, uY, uZ, vX, vY, vZ, r, g, b, emission
+//	3 plane:	type, x, y, z, normalX, normalY, normalZ, r, g, b, emission
+//
+//Blank lines are skipped. Meshes and instances are not described by scene files.
+
+const int SceneFileFields[] = { 9, 11, 14, 11 };	//Per type, including the type itself
+
+// Add the primitives in a scene file to scene. Returns 0 on success, 1 on error, with the
+// line number and reason in *error if given. On error the scene holds the lines before it
+inline int LoadSceneCSV(const std::string &filename, Scene &scene, std::string *error = nullptr)
+{
+	auto fail = [&](size_t line, const std::string &why)
+	{
+		if (error) *error = filename + (line ? ":" + std::to_string(line) : std::string()) + ": " + why;
+		return 1;
+	};
+
+	std::string buffer;
+	if (ReadWholeFile(filename, buffer)) return fail(0, "cannot read file");
+
+	const char *p = buffer.data(), *end = p + buffer.size();
+	size_t line = 0;
+	double f[14];
+
+	while (p < end)
+	{
+		line++;
+		const char *eol = p;
+		while (eol < end && *eol != '\n') eol++;
+
+		const char *q = p;
+		while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+		if (q == eol) { p = eol + (eol < end ? 1 : 0); continue; }
+
+		if (!(q = ParseDoubleField(q, eol, f[0]))) return fail(line, "expected a primitive type");
+		if (!(f[0] >= 0 && f[0] < double(std::size(SceneFileFields))) || f[0] != std::floor(f[0]))
+			return fail(line, "unknown primitive type");
+		int type = int(f[0]);
+
+		int fields = SceneFileFields[type];
+		for (int k = 1; k < fields; k++)
+		{
+			if (q >= eol) return fail(line, "expected " + std::to_string(fields) + " fields, found " + std::to_string(k));
+			if (!(q = ParseDoubleField(q, eol, f[k]))) return fail(line, "bad number in field " + std::to_string(k + 1));
+		}
+		const char *last = eol;		//The last field's comma is skipped like any other, so look for a dangling one
+		while (last > p && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r')) last--;
+		if (q < eol || last[-1] == ',') return fail(line, "more than " + std::to_string(fields) + " fields");
+
+		const double *c = f + fields - 4;		//Colour and emission close every layout
+		Vec3 col = Vec3(c[0], c[1], c[2]) / 255.0;
+		int mat = scene.AddMaterial(col, col*c[3]);
+
+		switch (type)
+		{
+		case PRIM_SPHERE:
+			if (f[4] <= 0) return fail(line, "radius must be positive");
+			scene.AddSphere({ f[1], f[2], f[3] }, f[4], mat);
+			break;
+		case PRIM_BOX:
+			if (f[4] <= 0 || f[5] <= 0 || f[6] <= 0) return fail(line, "half-extents must be positive");
+			scene.AddBox({ f[1], f[2], f[3] }, { f[4], f[5], f[6] }, mat);
+			break;
+		case PRIM_QUAD:
+			if (cross(Vec3(f[4], f[5], f[6]), Vec3(f[7], f[8], f[9])).norm2() == 0) return fail(line, "quad edges are parallel");
+			scene.AddQuad({ f[1], f[2], f[3] }, { f[4], f[5], f[6] }, { f[7], f[8], f[9] }, mat);
+			break;
+		case PRIM_PLANE:
+			if (Vec3(f[4], f[5], f[6]).norm2() == 0) return fail(line, "plane normal is zero");
+			scene.AddPlane({ f[1], f[2], f[3] }, { f[4], f[5], f[6] }, mat);
+			break;
+		}
+		p = eol + (eol < end ? 1 : 0);
+	}
+	return 0;
+}
+
+
+
+/*----Binary scene files----*/
+//The built scene's arrays written out as they sit in memory, BVH nodes included, so
+//loading maps the file and points the scene at it: no parsing, no copying, and pages
+//are only read when a ray first touches them. Native byte order and struct layout;
+//the header records both and a mismatch is refused rather than converted.
+//
+//	header, section table, then each section's array at a 64-byte aligned offset.
+//	Sections: materials, then geometry, material indices and BVH nodes for each of
+//	spheres, boxes, quads and planes. Meshes and instances cannot be stored.
+//
+//Every index the tracer follows, BVH child and leaf ranges and material indices, is
+//checked on load, so a corrupt file is refused rather than read out of bounds; that
+//reads the node and material index arrays once. Geometry is not checked.
+
+const uint32_t	SceneBinaryVersion = 1,
+				SceneBinaryEndian = 0x01020304,
+				SceneBinarySections = 13;
+const char		SceneBinaryMagic[8] = { 'C', 'G', 'I', 'S', 'C', 'E', 'N', 'E' };
+
+struct SceneBinaryHeader
+{
+	char magic[8];
+	uint32_t version, endian, sections, reserved;
+};
+
+struct SceneBinarySection
+{
+	uint32_t id, elemSize;		//Element size guards against layout changes
+	uint64_t offset, count;
+};
+
+// True if the file starts like a binary scene file
+inline bool IsSceneBinary(const std::string &filename)
+{
+	char magic[8] = {};
+	ifstream ifs(filename, ios::binary);
+	return ifs.read(magic, 8) && std::memcmp(magic, SceneBinaryMagic, 8) == 0;
+}
+
+// Write a built scene. Returns 0 on success, 1 on error, with the reason in *error if given
+inline int SaveSceneBinary(const std::string &filename, const Scene &scene, std::string *error = nullptr)
+{
+	auto fail = [&](const std::string &why)
+	{
+		if (error) *error = filename + ": " + why;
+		return 1;
+	};
+	if (scene.meshes.Size() || scene.instances.Size()) return fail("meshes and instances cannot be stored in a binary scene");
+
+	struct Array { const void *data; uint64_t count; uint32_t elemSize; };
+	std::vector<Array> arrays;
+	auto add = [&](const auto &span) { arrays.push_back({ span.data, span.size, uint32_t(sizeof(*span.data)) }); };
+	auto addType = [&](const auto &prims)
+	{
+		add(prims.geom); add(prims.material); add(prims.nodes);
+		return prims.pendingGeom.empty();
+	};
+
+	add(scene.materials);
+	bool built = addType(scene.spheres) & addType(scene.boxes) & addType(scene.quads) & addType(scene.planes);
+	if (!built) return fail("scene has not been built");
+
+	SceneBinaryHeader header = {};
+	std::memcpy(header.magic, SceneBinaryMagic, 8);
+	header.version = SceneBinaryVersion;
+	header.endian = SceneBinaryEndian;
+	header.sections = SceneBinarySections;
+
+	std::vector<SceneBinarySection> table(SceneBinarySections);
+	uint64_t offset = sizeof(header) + sizeof(SceneBinarySection) * table.size();
+	for (uint32_t i = 0; i < SceneBinarySections; i++)
+	{
+		offset = (offset + 63) & ~uint64_t(63);
+		table[i] = { i, arrays[i].elemSize, offset, arrays[i].count };
+		offset += arrays[i].count * arrays[i].elemSize;
+	}
+
+	ofstream ofs(filename, ios::binary);
+	if (!ofs.is_open()) return fail("cannot open file for writing");
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(table.data()), sizeof(SceneBinarySection) * table.size());
+
+	const char zeros[64] = {};
+	for (uint32_t i = 0; i < SceneBinarySections; i++)
+	{
+		ofs.write(zeros, std::streamsize(table[i].offset - uint64_t(ofs.tellp())));
+		if (arrays[i].count) ofs.write(static_cast<const char*>(arrays[i].data), std::streamsize(arrays[i].count * arrays[i].elemSize));
+	}
+	if (!ofs.flush()) return fail("write failed");
+	return 0;
+}
+
+// Replace scene with the contents of a binary scene file, mapped into memory. The scene
+// keeps the mapping open until it is cleared. Returns 0 on success, 1 on error, leaving
+// the scene as it was
+inline int LoadSceneBinary(const std::string &filename, Scene &scene, std::string *error = nullptr)
+{
+	auto fail = [&](const std::string &why)
+	{
+		if (error) *error = filename + ": " + why;
+		return 1;
+	};
+
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (file->Open(filename)) return fail("cannot map file");
+
+	const unsigned char *base = file->Data();
+	size_t size = file->Size();
+	SceneBinaryHeader header;
+	if (size < sizeof(header)) return fail("not a binary scene file");
+	std::memcpy(&header, base, sizeof(header));
+
+	if (std::memcmp(header.magic, SceneBinaryMagic, 8) != 0) return fail("not a binary scene file");
+	if (header.endian != SceneBinaryEndian) return fail("written on a machine of the other byte order");
+	if (header.version != SceneBinaryVersion) return fail("unsupported version " + std::to_string(header.version));
+	if (header.sections != SceneBinarySections || size < sizeof(header) + sizeof(SceneBinarySection) * SceneBinarySections)
+		return fail("bad section table");
+
+	const SceneBinarySection *table = reinterpret_cast<const SceneBinarySection*>(base + sizeof(header));
+	uint32_t next = 0;
+	std::string problem;
+	auto get = [&](auto &span)
+	{
+		typedef typename std::remove_reference<decltype(*span.data)>::type T;
+		const SceneBinarySection &s = table[next];
+		if (s.id != next || s.elemSize != sizeof(T) || s.offset % alignof(T)
+			|| s.offset > size || s.count > (size - s.offset) / sizeof(T))
+			problem = "bad section " + std::to_string(next);
+		else span = { const_cast<T*>(reinterpret_cast<const T*>(base + s.offset)), size_t(s.count) };
+		next++;
+	};
+	auto getType = [&](auto &prims) { get(prims.geom); get(prims.material); get(prims.nodes); };
+
+	Span<Material> materials;
+	decltype(scene.spheres) spheres;
+	decltype(scene.boxes) boxes;
+	decltype(scene.quads) quads;
+	decltype(scene.planes) planes;
+	get(materials);
+	getType(spheres); getType(boxes); getType(quads); getType(planes);
+
+	auto check = [&](const auto &prims, const std::string &name)
+	{
+		if (!problem.empty()) return;
+		if (prims.material.size != prims.geom.size) { problem = name + ": material and primitive counts differ"; return; }
+		for (int m : prims.material)
+			if (m < 0 || size_t(m) >= materials.size) { problem = name + ": material index out of range"; return; }
+
+		std::vector<int> depth(prims.nodes.size, 0);		//Children follow their parent, so one pass finds every depth
+		for (size_t i = 0; i < prims.nodes.size; i++)
+		{
+			const BVHNode &n = prims.nodes[i];
+			bool ok = n.count > 0 ? n.leftFirst >= 0 && size_t(n.leftFirst) + size_t(n.count) <= prims.geom.size
+								  : n.count == 0 && n.leftFirst > int(i) && size_t(n.leftFirst) + 1 < prims.nodes.size;
+			if (!ok) { problem = name + ": BVH node " + std::to_string(i) + " out of range"; return; }
+			if (n.count > 0) continue;
+
+			if (depth[i] + 1 > BVH::MaxDepth) { problem = name + ": BVH deeper than " + std::to_string(BVH::MaxDepth) + " levels"; return; }
+			for (int c = n.leftFirst; c <= n.leftFirst + 1; c++) depth[c] = std::max(depth[c], depth[i] + 1);
+		}
+	};
+	check(spheres, "spheres"); check(boxes, "boxes"); check(quads, "quads"); check(planes, "planes");
+	if (!problem.empty()) return fail(problem);
+
+	auto use = [](auto &to, const auto &from) { to.geom = from.geom; to.material = from.material; to.nodes = from.nodes; };
+	scene.Clear();
+	scene.materials = materials;
+	use(scene.spheres, spheres); use(scene.boxes, boxes); use(scene.quads, quads); use(scene.planes, planes);
+	scene.backing = file;
+	return 0;
+}
+
+// Load a scene file of either kind, telling them apart by the binary header
+inline int LoadSceneFile(const std::string &filename, Scene &scene, std::string *error = nullptr)
+{
+	if (IsSceneBinary(filename)) return LoadSceneBinary(filename, scene, error);
+	return LoadSceneCSV(filename, scene, error);
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include "Scene.h"
+#include "Vec3.h"
+
+
+/*----Procedural scenes----*/
+//Scenes of any size for scaling tests, from tens to tens of millions of primitives.
+//Everything is a function of the settings alone: the same seed gives the same scene on
+//every platform, as only the raw mt19937_64 output is used, never std distributions.
+//All scenes sit in the view of the default camera, roughly x, y in [-5, 5], z in [0, 10],
+//and primitives share a small palette of materials rather than having one each.
+
+struct SceneGenSettings
+{
+	uint64_t seed = 1;
+	int lights = 4;				//Emitting spheres above the scene
+	double lightEmission = 4.0;
+	int palette = 16;			//Distinct diffuse materials
+};
+
+class SceneRandom
+{
+public:
+	explicit SceneRandom(uint64_t seed) : engine(seed) {}
+
+	double Uniform() { return double(engine() >> 11) * (1.0 / 9007199254740992.0); }	//[0, 1), 53 bits
+	double Uniform(double lo, double hi) { return lo + (hi - lo)*Uniform(); }
+	size_t Index(size_t n) { return size_t(Uniform() * double(n)); }
+
+private:
+	std::mt19937_64 engine;
+};
+
+// Diffuse materials in muted random colours. Returns the index of the first
+inline int AddPalette(Scene &scene, const SceneGenSettings &settings, SceneRandom &rng)
+{
+	int first = -1;
+	for (int i = 0; i < std::max(settings.palette, 1); i++)
+	{
+		int m = scene.AddMaterial({ rng.Uniform(0.2, 0.9), rng.Uniform(0.2, 0.9), rng.Uniform(0.2, 0.9) });
+		if (first < 0) first = m;
+	}
+	return first;
+}
+
+// Emitting spheres spread over a ring above the scene, out of direct view
+inline void AddGeneratedLights(Scene &scene, const SceneGenSettings &settings, SceneRandom &rng)
+{
+	if (settings.lights <= 0) return;
+	double e = settings.lightEmission;
+	int mat = scene.AddMaterial({ 1.0, 1.0, 1.0 }, { e, e, e });
+
+	for (int i = 0; i < settings.lights; i++)
+	{
+		double angle = 2.0 * 3.14159265358979323846 * (i + rng.Uniform(0.0, 0.5)) / settings.lights;
+		scene.AddSphere({ 6.0*std::cos(angle), 8.0, 5.0 + 6.0*std::sin(angle) }, 1.5, mat);
+	}
+}
+
+// count spheres scattered through the view volume, sized so the volume stays about as full
+// whatever the count. Overlaps are allowed
+inline void GenerateSphereField(Scene &scene, size_t count, const SceneGenSettings &settings = SceneGenSettings())
+{
+	SceneRandom rng(settings.seed);
+	int palette = AddPalette(scene, settings, rng);
+	double rad = std::min(1.0, 0.4 * std::cbrt(1000.0 / double(std::max<size_t>(count, 1))));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Vec3 centre = { rng.Uniform(-5.0, 5.0), rng.Uniform(-5.0, 5.0), rng.Uniform(0.0, 10.0) };
+		scene.AddSphere(centre, rad * rng.Uniform(0.5, 1.0), palette + int(rng.Index(size_t(std::max(settings.palette, 1)))));
+	}
+	AddGeneratedLights(scene, settings, rng);
+}
+
+// Number of spheres in a sphere-flake of the given depth: 1 + 9 + 81 + ...
+inline size_t SphereFlakeCount(int depth)
+{
+	size_t n = 0, level = 1;
+	for (int d = 0; d <= depth; d++, level *= 9) n += level;
+	return n;
+}
+
+// Haines' sphere-flake: every sphere carries nine spheres a third of its size, six round
+// its equator and three above, recursively. Depth 0 is a single sphere
+inline void GenerateSphereFlake(Scene &scene, int depth, const SceneGenSettings &settings = SceneGenSettings())
+{
+	SceneRandom rng(settings.seed);
+	int palette = AddPalette(scene, settings, rng), colours = std::max(settings.palette, 1);
+
+	struct Local { double x, y, z; };	//Child directions with the parent's axis as y
+	std::vector<Local> dirs;
+	for (int k = 0; k < 6; k++) dirs.push_back({ std::cos(k*3.14159265358979323846/3.0), 0.0, std::sin(k*3.14159265358979323846/3.0) });
+	for (int k = 0; k < 3; k++)
+	{
+		double a = (2*k + 1)*3.14159265358979323846/3.0;
+		dirs.push_back({ 0.5*std::cos(a), std::sqrt(0.75), 0.5*std::sin(a) });
+	}
+
+	struct Flake
+	{
+		static void Add(Scene &scene, const std::vector<Local> &dirs, const Vec3 &centre, double rad, const Vec3 &axis, int depth, int level, int palette, int colours)
+		{
+			scene.AddSphere(centre, rad, palette + level % colours);
+			if (depth == 0) return;
+
+			Vec3 a = cross(std::abs(axis.x) < 0.9 ? Vec3(1.0, 0.0, 0.0) : Vec3(0.0, 1.0, 0.0), axis);
+			a.normalise();
+			Vec3 b = cross(axis, a);
+			for (const Local &d : dirs)
+			{
+				Vec3 dir = d.x*a + d.y*axis + d.z*b;
+				Add(scene, dirs, centre + dir*(rad*4.0/3.0), rad/3.0, dir, depth - 1, level + 1, palette, colours);
+			}
+		}
+	};
+	Vec3 up = { 0.0, 1.0, 0.0 };
+	Flake::Add(scene, dirs, { 0.0, -1.0, 5.0 }, 2.0, up, std::max(depth, 0), 0, palette, colours);
+	AddGeneratedLights(scene, settings, rng);
+}
+
+// n by n grid of square tiles forming a wall across the back of the view, with a gap
+// between tiles, plus a floor quad under it
+inline void GenerateQuadGrid(Scene &scene, int n, const SceneGenSettings &settings = SceneGenSettings())
+{
+	SceneRandom rng(settings.seed);
+	int palette = AddPalette(scene, settings, rng), colours = std::max(settings.palette, 1);
+	n = std::max(n, 1);
+
+	double cell = 10.0 / n, tile = 0.9 * cell;
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < n; j++)
+			scene.AddQuad(	{ -5.0 + i*cell, -5.0 + j*cell, 9.0 + rng.Uniform(-0.5, 0.5)*cell },
+							{ tile, 0.0, 0.0 }, { 0.0, tile, 0.0 },
+							palette + int(rng.Index(size_t(colours))));
+
+	scene.AddQuad({ -6.0, -5.0, 0.0 }, { 0.0, 0.0, 10.0 }, { 12.0, 0.0, 0.0 }, palette);
+	AddGeneratedLights(scene, settings, rng);
+}
+
+// Generate a scene by name: "field", "flake" or "grid", with about count primitives (for
+// flakes the deepest flake not above count, for grids the nearest square). Returns 0 on
+// success, 1 for an unknown name
+inline int GenerateScene(Scene &scene, const std::string &kind, size_t count, const SceneGenSettings &settings = SceneGenSettings())
+{
+	if (kind == "field") GenerateSphereField(scene, count, settings);
+	else if (kind == "flake")
+	{
+		int depth = 0;
+		while (SphereFlakeCount(depth + 1) <= count) depth++;
+		GenerateSphereFlake(scene, depth, settings);
+	}
+	else if (kind == "grid") GenerateQuadGrid(scene, int(std::lround(std::sqrt(double(count)))), settings);
+	else return 1;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <string>
+#include <vector>
+#include "Scene.h"
+#include "Vec3.h"
+
+
+/*----Built-in scenes----*/
+//The hand-written test scenes, selectable by name. Each comes with the settings it is
+//always rendered at, so timings and error figures from different runs compare, and with
+//a reference image rendered at many more samples, kept in references/<name>.pfm.
+
+struct RenderSettings
+{
+	int width, height, samples, bounces;
+};
+
+struct BuiltinScene
+{
+	const char *name, *description;
+	RenderSettings settings;
+	int referenceSamples;
+	void (*build)(Scene &scene);
+};
+
+inline void BuildTwoLights(Scene &scene)		//Two coloured lights with sphere in center
+{
+	scene.AddSphere(	{0.0, 0.0, 5.0}, 3.0,
+						{0.6, 0.6, 1.0});
+
+	scene.AddSphere(	{3.0, 3.0, 0.0}, 2.0,
+						{1.0, 1.0, 1.0},
+						{1.0, 1.0, 1.0});
+
+	scene.AddSphere(	{-3.0, -3.0, 0.0}, 2.0,
+						{1.0, 1.0, 1.0},
+						{1.0, 0.3, 0.3});
+}
+
+inline void BuildInsideSphere(Scene &scene)		//Camera inside sphere
+{
+	scene.AddSphere(	{ 0.0, 0.0, 0.0 }, 10.0,
+						{ 0.5, 0.5, 0.5 },
+						{ 0.5, 0.5, 0.5 });
+}
+
+inline void BuildSurrounding(Scene &scene)		//Surrounding emitting sphere, spheres inside
+{
+	scene.AddSphere(	{ 0.0, 0.0, 5.0 }, 3.0,
+						{ 0.0, 0.0, 1.0 },
+						{ 0.0, 0.0, 1.0 });
+	scene.AddSphere(	{ 5.0, 0.0, 3.0 }, 3.0,
+						{ 0.0, 0.0, 1.0 },
+						{ 1.0, 0.0, 0.0 });
+	scene.AddSphere(	{ 0.0, 0.0, 1.0 }, 50.0,
+						{ 0.0, 0.0, 0.0 },
+						{ 0.7, 0.7, 0.7 });
+}
+
+inline void BuildLineOfSpheres(Scene &scene)	//Emitting sphere, line of spheres below
+{
+	scene.AddSphere(	{ 0.0, 2.0, 0.0 }, 0.5,
+						{ 1.0, 1.0, 1.0 },
+						{ 1.0, 1.0, 1.0 });
+	scene.AddSphere(	{ 0.0, 1.0, 0.0 }, 0.3,
+						{ 1.0, 0.0, 0.0 });
+	scene.AddSphere(	{ 0.0, 0.0, 0.0 }, 0.4,
+						{ 0.0, 1.0, 0.0 });
+	scene.AddSphere(	{ 0.0, -1.0, 0.0 }, 0.5,
+						{ 0.0, 0.0, 1.0 });
+}
+
+inline void BuildLogo(Scene &scene)				//Project logo
+{
+	scene.AddSphere(	{ 0.0, 2.0, 0.0 }, 1.0,
+						{ 1.0, 1.0, 1.0 },
+						{ 1.0, 1.0, 1.0 });
+	scene.AddSphere(	{ -2.0, 1.0, 0.0 }, 0.4,
+						{ 1.0, 0.0, 0.0 });
+	scene.AddSphere(	{ -1.1, 0.3, 0.0 }, 0.4,
+						{ 1.0, 1.0, 0.0 });
+	scene.AddSphere(	{ 0.0, 0.0, 0.0 }, 0.4,
+						{ 0.0, 1.0, 0.0 });
+	scene.AddSphere(	{ 1.1, 0.3, 0.0 }, 0.4,
+						{ 0.0, 1.0, 0.1 });
+	scene.AddSphere(	{ 2.0, 1.0, 0.0 }, 0.4,
+						{ 0.0, 0.0, 0.1 });
+}
+
+inline void BuildCornellBox(Scene &scene)
+{
+	scene.AddQuad(	{ -3.0, -3.0, 0.0 }, { 6.0, 0.0, 0.0 }, { 0.0, 0.0, 8.0 },
+					{ 1.0, 1.0, 1.0 });//Floor
+	scene.AddQuad(	{ -3.0, 3.0, 0.0 }, { 6.0, 0.0, 0.0 }, { 0.0, 0.0, 8.0 },
+					{ 1.0, 1.0, 1.0 });//Ceiling
+	scene.AddQuad(	{ -1.0, 2.99, 4.0 }, { 2.0, 0.0, 0.0 }, { 0.0, 0.0, 2.0 },
+					{ 1.0, 1.0, 1.0 },
+					{ 5.0, 5.0, 5.0 });//Ceiling lamp
+	scene.AddQuad(	{ -3.0, -3.0, 8.0 }, { 6.0, 0.0, 0.0 }, { 0.0, 6.0, 0.0 },
+					{ 1.0, 1.0, 1.0 });//Back wall
+	scene.AddQuad(	{ -3.0, -3.0, 0.0 }, { 0.0, 6.0, 0.0 }, { 0.0, 0.0, 8.0 },
+					{ 1.0, 0.0, 0.0 });//Left wall, red
+	scene.AddQuad(	{ 3.0, -3.0, 0.0 }, { 0.0, 6.0, 0.0 }, { 0.0, 0.0, 8.0 },
+					{ 0.0, 1.0, 0.0 });//Right wall, green
+	scene.AddBox(	{ 1.0, -2.1, 3.5 }, { 0.9, 0.9, 0.9 },
+					{ 1.0, 1.0, 1.0 });//Right box, small
+	scene.AddSphere(	{ -1.0, -1.8, 6.0 }, 1.2,
+						{ 1.0, 1.0, 1.0 });//Left sphere, larger
+}
+
+// The first entry is the default scene
+inline const std::vector<BuiltinScene> &BuiltinScenes()
+{
+	static const std::vector<BuiltinScene> scenes = {
+		{ "two-lights",		"Two coloured lights with sphere in center",			{ 128, 128, 64, 10 }, 4096, BuildTwoLights },
+		{ "inside-sphere",	"Camera inside an emitting sphere",						{ 128, 128, 64, 10 }, 4096, BuildInsideSphere },
+		{ "surrounding",	"Surrounding emitting sphere, spheres inside",			{ 128, 128, 64, 10 }, 4096, BuildSurrounding },
+		{ "line",			"Emitting sphere, line of spheres below",				{ 128, 128, 64, 10 }, 4096, BuildLineOfSpheres },
+		{ "logo",			"Project logo",											{ 128, 128, 64, 10 }, 4096, BuildLogo },
+		{ "cornell",		"Cornell box with a ceiling lamp, a box and a sphere",	{ 128, 128, 64, 10 }, 4096, BuildCornellBox },
+	};
+	return scenes;
+}
+
+// Scene called name, or nullptr
+inline const BuiltinScene *FindBuiltinScene(const std::string &name)
+{
+	for (const BuiltinScene &s : BuiltinScenes())
+		if (name == s.name) return &s;
+	return nullptr;
+}
+
+inline std::string ReferenceImagePath(const BuiltinScene &s)
+{
+	return std::string("references/") + s.name + ".pfm";
+}
+
+#endif
@@ -1,12 +1,30 @@
 /*----Includes----*/
 
+#include <algorithm>
+#include <atomic>
+#include "Benchmark.h"
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include "file_loading.h"
 #include <fstream>
+#include "Heatmap.h"
 #include "Image.h"
+#include "Instance.h"
 #include <iostream>
+#include "Mesh.h"
+#include "Parallel.h"
+#include "PerfCounters.h"
 #include <random>
+#include <sstream>
+#include "Scene.h"
+#include "SceneFile.h"
+#include "SceneGenerator.h"
+#include "Scenes.h"
+#include "Stats.h"
 #include <string>
+#include "Trace.h"
 #include "Vec3.h"
 #include <vector>
 
@@ -23,116 +41,47 @@ const Vec3		cam = { 0.0, 0.0, -sceneSize / (2.0 * std::tan(fov*pi / 360.0)) }, /
 				bg	= { 0.0, 0.0, 0.0 };	//Background colour
 
 
-/*----Classes----*/
+/*----Scene----*/
 
-class Object
-{
-public:
-	int type;
-	Vec3 origin;
-	Vec3 emit;
-	Vec3 col;
-	Vec3 lightPos;
-
-	Object(	int type,
-			Vec3 xyz = { 0.0, 0.0, 0.0 },
-			Vec3 rgb = { 1.0, 1.0, 1.0 }, //RGB 0-1
-			Vec3 L_e = { 0.0, 0.0, 0.0 })
-	{
-		origin = xyz;
-		col = rgb;// / pi;
-		emit = L_e;
-		lightPos = {};
-	};
-
-	virtual Vec3 BRDF(Vec3 destDir, Vec3 srcDir)
-	{
-		return col/pi;		//Lambertian BRDF
-	};
-
-	virtual bool Intersect(Vec3 sourcePos, Vec3 targetDir) = 0;
-
-	virtual Vec3 SurfaceNormal() = 0;
-};
+Scene scene;		//Built once before rendering, read-only while tracing
 
-class Sphere : public Object
+Vec3 BRDF(const Material &mat, Vec3 destDir, Vec3 srcDir)
 {
-public:
-	double rad;
-
-	Sphere(	Vec3 xyz = { 0.0, 0.0, 0.0 }, double r = 1.0,
-			Vec3 rgb = { 1.0, 1.0, 1.0 },
-			Vec3 L_e = { 0.0, 0.0, 0.0 }) : Object(0, xyz, rgb, L_e)
-	{
-		rad = r;
-	};
-
-	bool Intersect(Vec3 srcPos, Vec3 destDir) override
-	{
-		double	a = destDir.norm2(),
-				b = 2 * dot(destDir, srcPos - origin),
-				c = (srcPos - origin).norm2() - pow(rad, 2.0),
-				det = b * b - 4 * a*c,
-				root1, root2;
-
-		if (det >= 0)
-		{
-			root1 = (-b + sqrt(det)) / (2 * a);
-			root2 = (-b - sqrt(det)) / (2 * a);
+	return mat.col/pi;		//Lambertian BRDF
+};
 
-			//Both points of intersection are BEHIND the ray start point
-			if (root1 <= 0 && root2 <= 0)
-			{
-				lightPos = {};
-				return false;
-			}
 
-			//Are ~both~ points of intersection ahead the ray start point?
-			//If yes, choose the closest. Else, the ray start point is inside the object, choose the intersection point ahead
-			/*if (root1 >= 0 && root2 >= 0)
-			{
-				lightPos = srcPos + (std::min(root1, root2))*destDir;
-				return true;
-			}
-			lightPos = srcPos + (std::max(root1, root2))*destDir;*/
-			lightPos = srcPos + destDir*((root1 >= 0 && root2 >= 0) ? std::min(root1, root2) : std::max(root1, root2));
-			return true;
-		}
+/*----Utility Functions----*/
 
-		lightPos = {};
-		return false;
-	};
+std::random_device rand_dev; // Set up a "random device" that generates a new random number each time the program is run
+uint64_t renderSeed = (uint64_t(rand_dev()) << 32) | rand_dev();	//New each run, fixed by --regress; every random stream derives from it
+std::atomic<uint64_t> threadStreams(0);
 
-	Vec3 SurfaceNormal() override
-	{
-		Vec3 n = lightPos - origin; n.normalise();
-		return n;
-	};
-};	vector<Sphere*> objects;		//TODO: fix
+uint64_t StreamSeed(uint64_t a, uint64_t b)		//Mixes two values into a seed (splitmix64 finaliser)
+{
+	uint64_t z = a + 0x9E3779B97F4A7C15ull * (b + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
 
-class Rectangle : public Object
+class SampleRandom		//splitmix64: one word of state, so reseeding for every block of samples costs nothing
 {
 public:
-	Vec3 dim = { 1.0, 1.0, 1.0 };
+	typedef uint64_t result_type;
+	explicit SampleRandom(uint64_t seed) : state(seed) {}
 
-	Rectangle(	Vec3 xyz = { 0.0, 0.0, 0.0 },
-				Vec3 hlw = { 1.0, 1.0, 1.0 },
-				Vec3 rgb = { 1.0, 1.0, 1.0 },
-				Vec3 L_e = { 0.0, 0.0, 0.0 }) : Object(1, xyz, rgb, L_e)
-	{
-		dim = hlw;
-	};
+	void seed(uint64_t s) { state = s; }
+	static constexpr uint64_t min() { return 0; }
+	static constexpr uint64_t max() { return ~uint64_t(0); }
+	uint64_t operator()() { return StreamSeed(state += 0x9E3779B97F4A7C15ull, 0); }
 
-	bool Intersect(Vec3 srcPos, Vec3 destDir) override
-	{};
+private:
+	uint64_t state;
 };
 
-
-/*----Utility Functions----*/
-
-std::random_device rand_dev; // Set up a "random device" that generates a new random number each time the program is run
-std::mt19937 rnd(rand_dev()); // Set up a pseudo-random number generater "rnd", seeded with a random number
-std::uniform_real_distribution<> dis(0, 1);
+thread_local SampleRandom rnd(StreamSeed(renderSeed, threadStreams++)); // Pseudo-random number generator "rnd", one per thread
+thread_local std::uniform_real_distribution<> dis(0, 1);
 
 Vec3 alignVec(const Vec3 &v, const Vec3 &n)		//Change of baseeeees
 {
@@ -163,16 +112,12 @@ double ProbDist(Vec3 dir)
 	return 1.0 / (2.0*pi);
 };
 
-Object* SourceSurface(Vec3 destPos, Vec3 srcDir)		//(3)x_M(x, w_i)
+thread_local uint64_t raysTraced = 0;		//Rays cast by this thread, for throughput figures
+
+bool SourceSurface(Vec3 destPos, Vec3 srcDir, Hit &hit)		//(3)x_M(x, w_i)
 {
-	Object* surface = nullptr;
-	for (auto& obj : objects)
-	{
-		if (obj->Intersect(destPos, srcDir)
-			&& (!surface || (obj->origin - destPos).norm() < (surface->origin - destPos).norm()))
-			surface = obj;
-	};
-	return surface;
+	raysTraced++;
+	return scene.Intersect(destPos, srcDir, hit);		//Closest hit point over every primitive type
 };
 
 
@@ -180,21 +125,22 @@ Object* SourceSurface(Vec3 destPos, Vec3 srcDir)		//(3)x_M(x, w_i)
 
 Vec3 IncomingLight(Vec3 destPos, Vec3 srcDir, int bounce = 0);	//Forward declaration
 
-Vec3 OutgoingLight(Object* sourceObject, Vec3 destDir, int bounce)		//(9)L_o(x_0, w_0)
+Vec3 OutgoingLight(const Hit &source, Vec3 destDir, int bounce)		//(9)L_o(x_0, w_0)
 {
-	if (dis(rnd) >= RR) return { 0.0, 0.0, 0.0 };
-	if (bounce >= PathTracingBounces) return sourceObject->emit;
+	const Material &mat = scene.materials[source.material];
+	if (dis(rnd) >= RR) { STAT(rouletteKills); return { 0.0, 0.0, 0.0 }; }
+	if (bounce >= PathTracingBounces) { STAT(bounceCaps); return mat.emit; }
 
-	Vec3 objNorm = sourceObject->SurfaceNormal(),
+	Vec3 objNorm = source.normal,
 		 srcDir = randVec();
 
 	if (dot(destDir, objNorm) < 0) objNorm *= -1.0;	//Ray from inside the sphere, hence inverted normal
 	srcDir = alignVec(srcDir, objNorm);
 
-	Vec3 returnval = sourceObject->emit +
-		 (sourceObject->BRDF(destDir, srcDir) / ProbDist(destDir))*
+	Vec3 returnval = mat.emit +
+		 (BRDF(mat, destDir, srcDir) / ProbDist(destDir))*
 		 dot(srcDir, objNorm)*
-		 IncomingLight(sourceObject->lightPos + 1e-6 * objNorm, srcDir, bounce + 1);
+		 IncomingLight(source.pos + 1e-6 * objNorm, srcDir, bounce + 1);
 		 //*exp(-distance*absorptionPerDistance);
 
 	return (returnval / RR);
@@ -202,214 +148,884 @@ Vec3 OutgoingLight(Object* sourceObject, Vec3 destDir, int bounce)		//(9)L_o(x_0
 
 Vec3 IncomingLight(Vec3 destPos, Vec3 srcDir, int bounce)	//(4)L_i(x, w_i)
 {
-	Object* srcObj = SourceSurface(destPos, srcDir);
-	return (srcObj ? OutgoingLight(srcObj, -srcDir, bounce) : bg);
+	Hit hit;
+	STAT(raysPerDepth[std::min(bounce, RenderStats::MaxDepth - 1)]);
+	if (SourceSurface(destPos, srcDir, hit))
+	{
+		STAT(hits);
+		return OutgoingLight(hit, -srcDir, bounce);
+	}
+	STAT(misses);
+	return bg;
 };
 
-Vec3 PixVal(Image &img, double x, double y)		//(6)I_xy
+Vec3 CameraDir(int width, int height, double x, double y)
 {
-	x -= double(img.Width()) / 2.0; y = double(img.Height()) / 2.0 - y;						//Convert pixel coordinates to 3D scene coordinates
-	x *= 2.0*sceneSize / double(img.Width()); y *= 2.0*sceneSize / double(img.Height());	//Convert from image size to scene size
+	x -= double(width) / 2.0; y = double(height) / 2.0 - y;						//Convert pixel coordinates to 3D scene coordinates
+	x *= 2.0*sceneSize / double(width); y *= 2.0*sceneSize / double(height);	//Convert from image size to scene size
 	Vec3 d = Vec3(x, y, 0.0) - cam; d.normalise();											//Camera to pixel direction vector
+	return d;
+};
+
+//ParallelFor that credits the rays its workers trace to the calling thread, for throughput figures
+template<class Body>
+void ParallelForRays(int begin, int end, int grain, Body body)
+{
+	std::atomic<uint64_t> rays(0);
+	ParallelFor(begin, end, grain, [&](int lo, int hi)
+	{
+		uint64_t before = raysTraced;
+		body(lo, hi);
+		rays += raysTraced - before;
+		raysTraced = before;
+	});
+	raysTraced += rays;
+}
+
+//Frames with fewer tiles than threads cannot keep every thread busy on tiles, so their pixels' samples are split
+//instead. Parallel.h starts threads for every ParallelFor, which only pays for itself on a whole pixel's samples
+//when there are few pixels
+bool FewTiles(int width, int height)
+{
+	int tiles = ((width + Image::TileSize - 1) / Image::TileSize) * ((height + Image::TileSize - 1) / Image::TileSize);
+	return tiles < ThreadCount();
+}
+
+const int	SampleBlock = 32,			//Samples drawn from one random stream
+			ParallelSamples = 256;		//Fewest samples for which a pixel's blocks are spread over threads
+
+//Sum of samples [first, first + n) of pixel (x, y), and of their squares in sumSq if given. Each block of
+//SampleBlock samples reseeds rnd from the pixel and its first sample, and the block sums are added in order,
+//so the result is the same however many threads share the work. In frames with few tiles, pixels with many
+//samples are split across threads, so single pixels and tiny images use every core too
+Vec3 SampleSum(int width, int height, double x, double y, int first, int n, Vec3 *sumSq = nullptr)
+{
+	Vec3 d = CameraDir(width, height, x, y);
+	uint64_t pixel = StreamSeed(StreamSeed(renderSeed, std::llround(x * 65536.0)), std::llround(y * 65536.0));
+	int nBlocks = (n + SampleBlock - 1) / SampleBlock;
+
+	auto block = [&](int b, Vec3 &sum, Vec3 &sq)
+	{
+		int lo = first + b * SampleBlock, hi = std::min(lo + SampleBlock, first + n);
+		rnd.seed(StreamSeed(pixel, uint64_t(lo)));
+		for (int i = lo; i < hi; i++)
+		{
+			Vec3 L = IncomingLight(cam, d);
+			sum += L;
+			sq += L * L;
+		}
+	};
+
+	Vec3 sum, sq;
+	if (n < ParallelSamples || ThreadCount() == 1 || !FewTiles(width, height))
+		for (int b = 0; b < nBlocks; b++)
+		{
+			Vec3 blockSum, blockSq;
+			block(b, blockSum, blockSq);
+			sum += blockSum;
+			sq += blockSq;
+		}
+	else
+	{
+		std::vector<Vec3> sums(nBlocks), sqs(nBlocks);
+		ParallelForRays(0, nBlocks, 1, [&](int lo, int hi)
+		{
+			TRACE_SCOPE("samples", int(x), int(y));
+			for (int b = lo; b < hi; b++) block(b, sums[b], sqs[b]);
+		});
+		for (int b = 0; b < nBlocks; b++)
+		{
+			sum += sums[b];
+			sq += sqs[b];
+		}
+	}
+	if (sumSq) *sumSq += sq;
+	return sum;
+};
+
+Vec3 PixVal(int width, int height, double x, double y)		//(6)I_xy
+{
+	return SampleSum(width, height, x, y, 0, NSamples) / NSamples;
+};
+
+Vec3 PixVal(Image &img, double x, double y)
+{
+	return PixVal(img.Width(), img.Height(), x, y);
+};
 
-	Vec3 PixelValue = { 0, 0, 0 };
-	for (int i = 0; i < NSamples; i++)
+struct SampleStats		//Running sums of one pixel's samples, so more can be added later
+{
+	Vec3 sum, sumSq;
+	int n = 0;
+
+	Vec3 Mean() const { return sum / n; }
+	Vec3 Variance() const { return n > 1 ? (sumSq - sum * sum / n) / (n - 1) : Vec3(); }	//Of one sample, per channel
+};
+
+void AccumulatePixel(int width, int height, double x, double y, int samples, SampleStats &stats)
+{
+	stats.sum += SampleSum(width, height, x, y, stats.n, samples, &stats.sumSq);
+	stats.n += samples;
+};
+
+
+//Calls fn(tile) for each tile of a width x height frame in Z-order, spread over threads unless the frame has too
+//few tiles to share (see FewTiles). Pixels are written by one thread each, so fn needs no locking for per-pixel data
+template<class Fn>
+void ForEachTileParallel(int width, int height, Fn fn)
+{
+	std::vector<TileRect> tiles = MortonTiles(width, height, Image::TileSize);
+	if (FewTiles(width, height))
 	{
-		PixelValue += IncomingLight(cam, d);
+		for (const TileRect &tile : tiles) fn(tile);
+		return;
 	}
-	return PixelValue / NSamples;
+	ParallelForRays(0, int(tiles.size()), 1, [&](int lo, int hi)
+	{
+		for (int t = lo; t < hi; t++) fn(tiles[t]);
+	});
+}
+
+PixelCostMap *pixelCosts = nullptr;		//If set, Render adds the time each pixel takes
+
+void Render(Image &img)
+{
+	TRACE_SCOPE("render");
+	ForEachTileParallel(img.Width(), img.Height(), [&](const TileRect &tile)		//Z-order over tiles and pixels keeps neighbouring rays together
+	{
+		TRACE_SCOPE("tile", tile.x0, tile.y0);
+		ForEachPixelMorton(tile, [&](int x, int y)
+		{
+			uint64_t start = pixelCosts ? CycleCount() : 0;
+			img.Set(x, y, PixVal(img, x, y));
+			if (pixelCosts) pixelCosts->Add(x, y, CycleCount() - start);
+		});
+	});
+};
+
+//Progressive rendering: adds samples more samples to every pixel's running sums (stats, indexed x + y*width)
+//and sets img to the new means. Plain Render always draws the same first samples, so repeating it adds nothing
+void RenderMore(Image &img, std::vector<SampleStats> &stats, int samples)
+{
+	TRACE_SCOPE("render");
+	int w = img.Width(), h = img.Height();
+	ForEachTileParallel(w, h, [&](const TileRect &tile)
+	{
+		TRACE_SCOPE("tile", tile.x0, tile.y0);
+		ForEachPixelMorton(tile, [&](int x, int y)
+		{
+			SampleStats &p = stats[x + size_t(y) * w];
+			AccumulatePixel(w, h, x, y, samples, p);
+			img.Set(x, y, p.Mean());
+		});
+	});
 };
 
 
 /*----Main----*/
+//Makes a built-in scene the current one, with its render settings
+void UseBuiltinScene(const BuiltinScene &s)
+{
+	scene.Clear();
+	s.build(scene);
+	scene.Build();
+	NSamples = s.settings.samples;
+	PathTracingBounces = s.settings.bounces;
+}
+
 int main_Image(int h = 1, int w = 1)
 {
-	Image img(h, w);
-	for (int y = 0; y <= h - 1; y++)
+	Image img(w, h, PixelLayout::Tiled);
+	ResetStats();
+	Render(img);
+	if (StatsEnabled) StatsTotal().Print(std::cout);
+	TRACE_SCOPE("save");
+	img.Save("output.png");
+	return 0;
+}
+
+//Renders and writes out a band of rows at a time, for resolutions whose full framebuffer would not fit in memory.
+//Each band's tiles are spread over threads as in Render. Stops at the first write that fails
+int main_ImageStreamed(int h = 1, int w = 1, int band = 32)
+{
+	PngWriter png;
+	if (!png.Open("output.png", w, h)) { std::cout << "Cannot write output.png" << std::endl; return 1; }
+
+	Image strip(w, band);
+	for (int y0 = 0; y0 < h; y0 += band)
 	{
-		for (int x = 0; x <= w - 1; x++)
+		TRACE_SCOPE("band", 0, y0);
+		int rows = std::min(band, h - y0);
+		ForEachTileParallel(w, rows, [&](const TileRect &tile)
+		{
+			TRACE_SCOPE("tile", tile.x0, y0 + tile.y0);
+			ForEachPixelMorton(tile, [&](int x, int y)
+			{
+				strip.Set(x, y, PixVal(w, h, x, y0 + y));
+			});
+		});
+		if (!strip.WriteRows(png, rows))
 		{
-			img(x, y) = PixVal(img, x, y);
+			std::cout << "Writing output.png failed at row " << y0 << std::endl;
+			png.Close();
+			return 1;
 		}
 	}
-	img.Save("output.png");
-	return 0;
+	return !png.Close();
 }
 
-int main_SinglePixel(int n = 1)
+int main_SinglePixel(int n = 1)		//n independent estimates, each from fresh samples
 {
-	Image img(1, 1);
+	SampleStats stats;
 	for (int i = 0; i <= n - 1; i++)
 	{
-		std::cout << PixVal(img, 0, 0).x << std::endl;
+		Vec3 before = stats.sum;
+		AccumulatePixel(1, 1, 0, 0, NSamples, stats);
+		std::cout << ((stats.sum - before) / NSamples).x << std::endl;
 	}
 	return 0;
 }
 
-int main_VariedSampling(double n = 1, double k = 1, int count = 1)
+//Renders a built-in scene at its settings and reports what the tracer did (see Stats.h), as JSON to
+//jsonFile if given. Needs a build with CGI_STATS defined
+int main_Stats(const std::string &name, const std::string &jsonFile = "")
 {
-	/*
-	Image img(1, 1);
-	for (double i = n; i <= n*pow(k, count); i *= k)
+	if (!StatsEnabled) { std::cout << "Statistics are not compiled in; build with CGI_STATS defined" << std::endl; return 1; }
+	const BuiltinScene *s = FindBuiltinScene(name);
+	if (!s) { std::cout << "Unknown scene " << name << std::endl; return 1; }
+
+	UseBuiltinScene(*s);
+	Image img(s->settings.width, s->settings.height, PixelLayout::Tiled);
+	ResetStats();
+	Render(img);
+
+	RenderStats stats = StatsTotal();
+	stats.Print(std::cout);
+	if (!jsonFile.empty())
+	{
+		std::ofstream ofs(jsonFile);
+		stats.WriteJSON(ofs);
+		if (!ofs) { std::cout << "Cannot write " << jsonFile << std::endl; return 1; }
+	}
+	return 0;
+}
+
+//Renders a built-in scene timing every pixel; writes a false-colour map of the costs to heatmapFile
+//(see Heatmap.h) and prints a summary and histogram of them
+int main_Heatmap(const std::string &name, const std::string &heatmapFile = "heatmap.png")
+{
+	const BuiltinScene *s = FindBuiltinScene(name);
+	if (!s) { std::cout << "Unknown scene " << name << std::endl; return 1; }
+
+	UseBuiltinScene(*s);
+	int w = s->settings.width, h = s->settings.height;
+	Image img(w, h, PixelLayout::Tiled);
+	PixelCostMap costs(w, h);
+	pixelCosts = &costs;
+	Render(img);
+	pixelCosts = nullptr;
+
+	if (costs.SaveHeatmap(heatmapFile)) { std::cout << "Cannot write " << heatmapFile << std::endl; return 1; }
+
+	std::vector<uint64_t> sorted;
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++) sorted.push_back(costs(x, y));
+	std::sort(sorted.rbegin(), sorted.rend());
+	uint64_t total = costs.Total(), top = 0;
+	for (size_t i = 0; i < sorted.size() / 10; i++) top += sorted[i];
+
+	std::cout << "per pixel (" << CycleUnit() << "): mean " << total / sorted.size() << ", median " << costs.Quantile(0.5)
+			  << ", 99th percentile " << costs.Quantile(0.99) << ", max " << sorted.front() << std::endl
+			  << "costliest 10% of pixels: " << 100.0 * top / std::max<uint64_t>(total, 1) << "% of the time" << std::endl;
+	costs.WriteHistogram(std::cout);
+	return 0;
+}
+
+//Renders a built-in scene and saves it to output.png under hardware performance counters (see PerfCounters.h),
+//reporting per phase IPC and misses per ray (per pixel for the save). Counters that cannot be opened, as in
+//many containers and virtual machines, are reported as unavailable and the phases are still timed
+int main_Perf(const std::string &name)
+{
+	const BuiltinScene *s = FindBuiltinScene(name);
+	if (!s) { std::cout << "Unknown scene " << name << std::endl; return 1; }
+
+	PerfCounters counters;
+	if (!counters.AnyHardware()) std::cout << "No hardware counters: " << counters.Error() << std::endl;
+	else if (!counters.Error().empty()) std::cout << "Some counters unavailable: " << counters.Error() << std::endl;
+
+	struct Phase { const char *name; double seconds; PerfReading counts; uint64_t items; const char *unit; };
+	std::vector<Phase> phases;
+	auto measure = [&](const char *phase, const char *unit, auto fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		counters.Start();
+		uint64_t items = fn();
+		PerfReading counts = counters.Stop();
+		phases.push_back({ phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), counts, items, unit });
+	};
+
+	Image img(s->settings.width, s->settings.height, PixelLayout::Tiled);
+	measure("build", "primitive", [&]() { UseBuiltinScene(*s); return uint64_t(scene.Primitives()); });
+	measure("render", "ray", [&]() { uint64_t rays = raysTraced; Render(img); return raysTraced - rays; });
+	measure("save", "pixel", [&]() { img.Save("output.png"); return uint64_t(img.Width()) * img.Height(); });
+
+	auto field = [](double v) { return v < 0 ? std::string("n/a") : std::to_string(v); };
+	std::cout << "phase, seconds, cpu seconds, cycles, instructions, IPC, L1D misses, LLC misses, branch misses, "
+				 "items, L1D misses/item, LLC misses/item, branch misses/item" << std::endl;
+	for (const Phase &ph : phases)
+	{
+		const PerfReading &c = ph.counts;
+		auto count = [&](PerfCounter k) { return c.valid[k] ? std::to_string(uint64_t(c.value[k])) : std::string("n/a"); };
+		auto perItem = [&](PerfCounter k) { return c.valid[k] && ph.items ? field(c.value[k] / ph.items) : std::string("n/a"); };
+		std::cout << ph.name << ", " << ph.seconds << ", " << (c.valid[PERF_TASK_CLOCK] ? field(c.value[PERF_TASK_CLOCK] * 1e-9) : "n/a") << ", "
+				  << count(PERF_CYCLES) << ", " << count(PERF_INSTRUCTIONS) << ", " << field(c.Ratio(PERF_INSTRUCTIONS, PERF_CYCLES)) << ", "
+				  << count(PERF_L1D_MISSES) << ", " << count(PERF_LLC_MISSES) << ", " << count(PERF_BRANCH_MISSES) << ", "
+				  << ph.items << " " << ph.unit << "s, "
+				  << perItem(PERF_L1D_MISSES) << ", " << perItem(PERF_LLC_MISSES) << ", " << perItem(PERF_BRANCH_MISSES) << std::endl;
+	}
+	return 0;
+}
+
+//Convergence study of a built-in scene: estimates at n, n*k, n*k^2... samples (count+1 checkpoints), measured
+//against the reference image. Samples are accumulated across checkpoints, so the sweep costs as much as its
+//last point and seconds are cumulative. Variance is that of one sample and stderr that of the pixel estimate,
+//both averaged over pixels and channels (stderr as a root mean square, comparable with rmse). Writes CSV to
+//csvFile, or to the console if none is given
+int main_VariedSampling(const BuiltinScene &s, double n = 1, double k = 2, int count = 10, const std::string &csvFile = "")
+{
+	Image reference(1, 1);
+	if (LoadPFM(ReferenceImagePath(s), reference)
+		|| reference.Width() != s.settings.width || reference.Height() != s.settings.height)
 	{
-		NSamples = i;
-		std::cout << i << ", " << PixVal(img, 0, 0).x << std::endl;
-	}*/
+		std::cout << "No reference image for " << s.name << "; render one with --reference " << s.name << std::endl;
+		return 1;
+	}
+
+	std::ofstream file;
+	if (!csvFile.empty())
+	{
+		file.open(csvFile);
+		if (!file.is_open()) { std::cout << "Cannot write " << csvFile << std::endl; return 1; }
+	}
+	std::ostream &os = csvFile.empty() ? std::cout : file;
+
+	UseBuiltinScene(s);
+	int w = s.settings.width, h = s.settings.height, done = 0;
+	std::vector<SampleStats> stats(size_t(w) * h);
+	Image img(w, h, PixelLayout::Tiled);
+	double seconds = 0.0;
+
+	os << "samples, seconds, rmse, relmse, psnr, variance, stderr" << std::endl;
 	for (double i = n; i <= n * pow(k, count); i *= k)
 	{
-		NSamples = i;
-		std::cout << i << std::endl;
-		main_SinglePixel(100);
+		int more = int(i) - done;
+		if (more <= 0) continue;
+
+		auto start = std::chrono::steady_clock::now();
+		RenderMore(img, stats, more);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		done += more;
+
+		double variance = 0.0;
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+			{
+				Vec3 v = stats[x + size_t(y) * w].Variance();
+				variance += (v.x + v.y + v.z) / (3.0 * w * h);
+			}
+		os << done << ", " << seconds << ", " << RMSE(img, reference) << ", " << RelMSE(img, reference) << ", "
+		   << PSNR(img, reference) << ", " << variance << ", " << std::sqrt(variance / done) << std::endl;
+	}
+	return 0;
+}
+
+//Times the tracer's building blocks and whole frames on a generated scene; writes JSON to jsonFile if given
+int main_Benchmark(const std::string &jsonFile = "")
+{
+	BenchSuite suite;
+	SceneRandom rng(1);
+	const int nRays = 1 << 16;
+
+	std::vector<Vec3> dirs(nRays), origins(nRays);		//Camera rays through the view, and rays from inside the scene
+	for (int i = 0; i < nRays; i++)
+	{
+		dirs[i] = Vec3(rng.Uniform(-sceneSize, sceneSize), rng.Uniform(-sceneSize, sceneSize), 0.0) - cam;
+		dirs[i].normalise();
+		origins[i] = { rng.Uniform(-5.0, 5.0), rng.Uniform(-5.0, 5.0), rng.Uniform(0.0, 10.0) };
+	}
+
+	suite.Run("sphere_intersect", "intersections", [&]()
+	{
+		SphereGeom sphere = { { 0.0, 0.0, 5.0 }, 3.0 };
+		int hits = 0;
+		for (int rep = 0; rep < 64; rep++)
+			for (int i = 0; i < nRays; i++)
+			{
+				double t = INFINITY;
+				Vec3 n;
+				hits += IntersectPrimitive(sphere, cam, dirs[i], t, n);
+			}
+		KeepResult(hits);
+		return uint64_t(64) * nRays;
+	});
+
+	suite.Run("randvec_alignvec", "calls", [&]()
+	{
+		Vec3 sum;
+		for (int rep = 0; rep < 16; rep++)
+			for (int i = 0; i < nRays; i++) sum += alignVec(randVec(), dirs[i]);
+		KeepResult(sum);
+		return uint64_t(16) * nRays;
+	});
+
+	const size_t spheres = 10000;
+	scene.Clear();
+	GenerateScene(scene, "field", spheres);
+	scene.Build();
+
+	suite.Run("source_surface", "rays", [&]()
+	{
+		int hits = 0;
+		for (int i = 0; i < nRays; i++)
+		{
+			Hit hit;
+			hits += SourceSurface(origins[i], dirs[(i * 7) & (nRays - 1)], hit);
+		}
+		KeepResult(hits);
+		return uint64_t(nRays);
+	});
+
+	suite.Run("pixval", "samples", [&]()
+	{
+		Vec3 sum;
+		for (int y = 0; y < 8; y++)
+			for (int x = 0; x < 8; x++) sum += PixVal(64, 64, 8*x + 4, 8*y + 4);
+		KeepResult(sum);
+		return uint64_t(64) * NSamples;
+	});
+
+	suite.Run("frame_48x48", "rays", [&]()
+	{
+		uint64_t before = raysTraced;
+		Image img(48, 48, PixelLayout::Tiled);
+		Render(img);
+		KeepResult(img(24, 24));
+		return raysTraced - before;
+	});
+
+	suite.PrintTable(std::cout);
+	if (!jsonFile.empty())
+	{
+		std::ofstream ofs(jsonFile);
+		if (!ofs.is_open()) { std::cout << "Cannot write " << jsonFile << std::endl; return 1; }
+		suite.WriteJSON(ofs, {	{ "scene", "field " + std::to_string(spheres) + " seed 1" },
+								{ "samples_per_pixel", std::to_string(NSamples) },
+								{ "bounces", std::to_string(PathTracingBounces) } });
 	}
 	return 0;
 }
 
-int main()
+//Renders a built-in scene at its fixed settings to output.png
+int main_Scene(const std::string &name)
 {
-	//Reading file
-	/*
-	ifstream ifs("objects.txt");
-	if (ifs.is_open())
+	const BuiltinScene *s = FindBuiltinScene(name);
+	if (!s) { std::cout << "Unknown scene " << name << std::endl; return 1; }
+
+	UseBuiltinScene(*s);
+	return main_Image(s->settings.height, s->settings.width);
+}
+
+//Renders the reference image of one built-in scene, or of all of them, at its reference sample count
+int main_Reference(const std::string &name)
+{
+	for (const BuiltinScene &s : BuiltinScenes())
+	{
+		if (name != "all" && name != s.name) continue;
+
+		UseBuiltinScene(s);
+		NSamples = s.referenceSamples;
+		Image img(s.settings.width, s.settings.height, PixelLayout::Tiled);
+		Render(img);
+		if (img.SavePFM(ReferenceImagePath(s))) { std::cout << "Cannot write " << ReferenceImagePath(s) << std::endl; return 1; }
+		std::cout << s.name << ": " << ReferenceImagePath(s) << std::endl;
+		if (name != "all") return 0;
+	}
+	if (name != "all") { std::cout << "Unknown scene " << name << std::endl; return 1; }
+	return 0;
+}
+
+struct MatrixEntry
+{
+	const BuiltinScene *scene;
+	double seconds, raysPerSecond,
+		   rmse;		//Against the reference image, negative if there is none
+};
+
+//Renders every built-in scene at its settings, timing it and measuring its error against the reference
+std::vector<MatrixEntry> RenderMatrix()
+{
+	std::vector<MatrixEntry> entries;
+	for (const BuiltinScene &s : BuiltinScenes())
+	{
+		UseBuiltinScene(s);
+		Image img(s.settings.width, s.settings.height, PixelLayout::Tiled), reference(1, 1);
+
+		uint64_t rays = raysTraced;
+		auto start = std::chrono::steady_clock::now();
+		Render(img);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		rays = raysTraced - rays;
+
+		bool haveReference = !LoadPFM(ReferenceImagePath(s), reference)
+							 && reference.Width() == img.Width() && reference.Height() == img.Height();
+		entries.push_back({ &s, seconds, rays / seconds, haveReference ? RMSE(img, reference) : -1.0 });
+	}
+	return entries;
+}
+
+int main_Matrix()
+{
+	std::cout << "scene, seconds, Mrays/s, RMSE" << std::endl;
+	for (const MatrixEntry &e : RenderMatrix())
+	{
+		std::cout << e.scene->name << ", " << e.seconds << ", " << e.raysPerSecond / 1e6 << ", ";
+		if (e.rmse < 0) std::cout << "no reference" << std::endl;
+		else std::cout << e.rmse << std::endl;
+	}
+	return 0;
+}
+
+//Renders a scene at its fixed settings over and over until at least minSeconds have passed, so short
+//scenes take many frames and one frame caught by a context switch cannot decide the result; rays/s
+double MeasureThroughput(const BuiltinScene &s, double minSeconds = 0.5)
+{
+	UseBuiltinScene(s);
+	Image img(s.settings.width, s.settings.height, PixelLayout::Tiled);
+
+	uint64_t rays = raysTraced;
+	double seconds = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	do
+	{
+		Render(img);
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (seconds < minSeconds);
+	return (raysTraced - rays) / seconds;
+}
+
+//Samples per pixel the current scene's running mean needs to come within target RMSE of its reference,
+//adding passes of a few samples, or a negative value if maxSamples are used up first
+int SamplesToTarget(const Image &reference, double target, int maxSamples)
+{
+	const int PassSamples = 2;
+	int w = reference.Width(), h = reference.Height();
+	std::vector<SampleStats> stats(size_t(w) * h);
+	Image mean(w, h, PixelLayout::Tiled);
+
+	for (int samples = PassSamples; samples <= maxSamples; samples += PassSamples)
+	{
+		RenderMore(mean, stats, PassSamples);
+		if (RMSE(mean, reference) <= target) return samples;
+	}
+	return -1;
+}
+
+//Wall time of SamplesToTarget, averaged over as many runs as fit in minSeconds. The scene is built
+//beforehand, so only rendering is timed
+double TimeToTarget(const BuiltinScene &s, const Image &reference, double target, int maxSamples, double minSeconds = 0.5)
+{
+	UseBuiltinScene(s);
+	int runs = 0;
+	double seconds = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	do
 	{
-		DoubleCSVFile inputFile;
-		inputFile.Load(ifs);
+		if (SamplesToTarget(reference, target, maxSamples) < 0) return -1.0;
+		runs++;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (seconds < minSeconds);
+	return seconds / runs;
+}
 
-		for (const auto& line in inputFile)
+//Performance gate against the baseline file, with a fixed seed: returns 1 if throughput or time to target is
+//worse by more than tolerance (a fraction), or more samples are needed. With update, records a new baseline
+int main_Regression(double tolerance = 0.3, bool update = false, const std::string &baselineFile = "references/baseline.csv", int rounds = 5)
+{
+	std::vector<std::string> names;
+	std::vector<double> baseRays, baseSamples, baseTime, baseTarget;
+	if (!update)
+	{
+		StringViewCSVFile baseline;
+		if (baseline.LoadFile(baselineFile) || baseline.GetColumn("scene", names) || baseline.GetColumn("rays_per_second", baseRays)
+			|| baseline.GetColumn("samples_to_target", baseSamples) || baseline.GetColumn("time_to_target", baseTime)
+			|| baseline.GetColumn("target_rmse", baseTarget))
 		{
-			//Access line data?
-		};
-
-		inputFile.DisplayValues();
-		ifs.close();
-	};*/
-
-// Two coloured lights with sphere in center
-	objects.push_back(
-		new Sphere(	{0.0, 0.0, 5.0}, 3.0,
-					{0.6, 0.6, 1.0})
-	);
-
-	objects.push_back(
-		new Sphere(	{3.0, 3.0, 0.0}, 2.0,
-					{1.0, 1.0, 1.0},
-					{1.0, 1.0, 1.0})
-	);
-
-	objects.push_back(
-		new Sphere(	{-3.0, -3.0, 0.0}, 2.0,
-					{1.0, 1.0, 1.0},
-					{1.0, 0.3, 0.3})
-	);
-	
-	//Camera inside sphere 
-	/*
-	objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 0.0 }, 10.0,
-					{ 0.5, 0.5, 0.5 },
-					{ 0.5, 0.5, 0.5 })
-	);*/
-
-	//Surrounding emitting sphere, spheres inside; Sounds good, doesn't work
-	/*objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 5.0 }, 3.0,
-					{ 0.0, 0.0, 1.0 },
-					{ 0.0, 0.0, 1.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 5.0, 0.0, 3.0 }, 3.0,
-					{ 0.0, 0.0, 1.0 },
-					{ 1.0, 0.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 1.0 }, 50.0,
-					{ 0.0, 0.0, 0.0 },
-					{ 0.7, 0.7, 0.7 })
-	);*/
-
-	//Emitting sphere, line of spheres below
-	/*objects.push_back(
-		new Sphere(	{ 0.0, 2.0, 0.0 }, 0.5,
-					{ 1.0, 1.0, 1.0 },
-					{ 1.0, 1.0, 1.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 0.0, 1.0, 0.0 }, 0.3,
-					{ 1.0, 0.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 0.0 }, 0.4,
-					{ 0.0, 1.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 0.0, -1.0, 0.0 }, 0.5,
-					{ 0.0, 0.0, 1.0 })
-	);*/
-
-	//Project logo
+			std::cout << "Cannot read baseline " << baselineFile << "; run --regress-update to record one" << std::endl;
+			return 1;
+		}
+	}
+
+	renderSeed = 1;		//Same images and sample counts on every run, so only the timing varies
+	int failures = 0;
+
+	std::vector<const BuiltinScene*> scenes;
+	std::vector<Image> references;
+	std::vector<double> targets;		//Updating: 1.5 times the error at the fixed settings, i.e. about half the samples
+	for (const BuiltinScene &s : BuiltinScenes())
+	{
+		Image reference(1, 1);
+		size_t i = std::find(names.begin(), names.end(), s.name) - names.begin();
+		if (LoadPFM(ReferenceImagePath(s), reference) || reference.Width() != s.settings.width || reference.Height() != s.settings.height)
+		{
+			std::cout << s.name << ": no reference image" << std::endl;
+			failures++;
+			continue;
+		}
+		if (!update && i == names.size())
+		{
+			std::cout << s.name << ": not in the baseline" << std::endl;
+			failures++;
+			continue;
+		}
+
+		double target = update ? 0.0 : baseTarget[i];
+		if (update)
+		{
+			UseBuiltinScene(s);
+			Image img(s.settings.width, s.settings.height, PixelLayout::Tiled);
+			Render(img);
+			target = 1.5 * RMSE(img, reference);
+		}
+		scenes.push_back(&s);
+		references.push_back(std::move(reference));
+		targets.push_back(target);
+	}
+
+	//Rounds go through every scene, so a few seconds of a busy machine slow one try of a scene, not all
+	std::vector<double> rays(scenes.size(), 0.0), times(scenes.size(), -1.0);
+	for (int k = 0; k < rounds; k++)
+		for (size_t j = 0; j < scenes.size(); j++)
+		{
+			const BuiltinScene &s = *scenes[j];
+			rays[j] = std::max(rays[j], MeasureThroughput(s));
+			double t = TimeToTarget(s, references[j], targets[j], 16 * s.settings.samples);
+			if (t >= 0 && (times[j] < 0 || t < times[j])) times[j] = t;
+		}
+
+	std::ostringstream csv;
+	csv << "scene, rays_per_second, samples_to_target, time_to_target, target_rmse" << std::endl;
+	if (!update) std::cout << "scene, Mrays/s, baseline, samples to target, baseline, time to target (s), baseline, result" << std::endl;
+	for (size_t j = 0; j < scenes.size(); j++)
+	{
+		const BuiltinScene &s = *scenes[j];
+		size_t i = std::find(names.begin(), names.end(), s.name) - names.begin();
+		UseBuiltinScene(s);
+		int samples = SamplesToTarget(references[j], targets[j], 16 * s.settings.samples);
+		csv << s.name << ", " << rays[j] << ", " << samples << ", " << times[j] << ", " << targets[j] << std::endl;
+		if (update) continue;
+
+		bool slower = rays[j] < baseRays[i] * (1.0 - tolerance),
+			 moreSamples = samples < 0 || samples > baseSamples[i],
+			 later = times[j] < 0 || times[j] > baseTime[i] * (1.0 + tolerance);
+		failures += (slower || moreSamples || later);
+		std::cout << s.name << ", " << rays[j] / 1e6 << ", " << baseRays[i] / 1e6 << ", "
+				  << samples << ", " << baseSamples[i] << ", " << times[j] << ", " << baseTime[i] << ", "
+				  << (slower ? "SLOWER " : "") << (moreSamples ? "MORE SAMPLES " : "") << (later ? "CONVERGES LATER" : "")
+				  << (slower || moreSamples || later ? "" : "ok") << std::endl;
+	}
+
+	if (update)
+	{
+		std::ofstream ofs(baselineFile);
+		if (!(ofs << csv.str())) { std::cout << "Cannot write " << baselineFile << std::endl; return 1; }
+		std::cout << csv.str();
+		return failures ? 1 : 0;
+	}
+	std::cout << (failures ? "FAILED: " : "Passed: ") << failures << " regression(s), tolerance " << 100.0 * tolerance << "%" << std::endl;
+	return failures ? 1 : 0;
+}
+
+//Checks that a StringViewCSVFile copied or moved from another reads its own data: the source is destroyed
+//or reloaded first. Short and long files, the short one fitting in std::string's in-place buffer
+int main_SelfTest()
+{
+	int failures = 0;
+	auto check = [&](bool ok, const std::string &what)
+	{
+		std::cout << (ok ? "ok    " : "FAIL  ") << what << std::endl;
+		failures += !ok;
+	};
+
+	for (const std::string &text : { std::string("a, b\n1, 2\n"), "name, value\n" + std::string(200, 'x') + ", 42\n" })
+	{
+		std::string first = text.substr(0, text.find(',')), size = text.size() < 32 ? "short " : "long ";
+		auto load = [](StringViewCSVFile &csv, const std::string &t) { std::istringstream is(t); return csv.Load(is); };
+
+		StringViewCSVFile *source = new StringViewCSVFile;
+		load(*source, text);
+		StringViewCSVFile copy(*source), moved(std::move(*source));
+		delete source;
+		check(copy.Rows() == 2 && copy(0, 0) == first, size + "copy outlives its source");
+		check(moved.Rows() == 2 && moved(0, 0) == first, size + "move outlives its source");
+
+		StringViewCSVFile reloaded, assigned;
+		load(reloaded, text);
+		assigned = reloaded;
+		load(reloaded, "other\n");
+		check(assigned(0, 0) == first, size + "copy keeps its data when the source reloads");
+	}
+
+	std::cout << (failures ? "FAILED: " : "Passed: ") << failures << " failure(s)" << std::endl;
+	return failures ? 1 : 0;
+}
+
+//Converts a text scene file to a binary one, timing how long each takes to get ready to render
+int main_ConvertScene(const std::string &textFile, const std::string &binaryFile)
+{
+	typedef std::chrono::steady_clock Clock;
+	auto seconds = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double>(b - a).count(); };
+	std::string error;
+
+	Scene text;
+	Clock::time_point t0 = Clock::now();
+	if (LoadSceneCSV(textFile, text, &error)) { std::cout << error << std::endl; return 1; }
+	Clock::time_point t1 = Clock::now();
+	text.Build();
+	Clock::time_point t2 = Clock::now();
+	if (SaveSceneBinary(binaryFile, text, &error)) { std::cout << error << std::endl; return 1; }
+
+	Scene binary;
+	Clock::time_point t3 = Clock::now();
+	if (LoadSceneBinary(binaryFile, binary, &error)) { std::cout << error << std::endl; return 1; }
+	Clock::time_point t4 = Clock::now();
+
+	std::cout << text.Primitives() << " primitives" << std::endl
+			  << "Text:   " << seconds(t0, t1) << " s parse + " << seconds(t1, t2) << " s build" << std::endl
+			  << "Binary: " << seconds(t3, t4) << " s" << std::endl;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	//Timeline of phases, tiles and parallel blocks: --trace trace.json before any other arguments. See Trace.h
+	if (argc >= 3 && std::string(argv[1]) == "--trace")
+	{
+		StartTrace(argv[2]);
+		argv[2] = argv[0];
+		argc -= 2;
+		argv += 2;
+	}
+
+	//Benchmarks: --bench [results.json]
+	if (argc >= 2 && std::string(argv[1]) == "--bench") return main_Benchmark(argc > 2 ? argv[2] : "");
+
+	//Built-in scenes (Scenes.h): --scene name renders one at its settings, --streamed name height width [band]
+	//renders one band by band straight to output.png at any size, --reference name|all renders reference
+	//images, --matrix renders them all and reports time and error
+	if (argc == 3 && std::string(argv[1]) == "--scene") return main_Scene(argv[2]);
+	if (argc >= 5 && std::string(argv[1]) == "--streamed")
+	{
+		const BuiltinScene *s = FindBuiltinScene(argv[2]);
+		if (!s) { std::cout << "Unknown scene " << argv[2] << std::endl; return 1; }
+		int h = std::atoi(argv[3]), w = std::atoi(argv[4]), band = argc > 5 ? std::atoi(argv[5]) : 32;
+		if (h < 1 || w < 1 || band < 1) { std::cout << "Height, width and band must be positive" << std::endl; return 1; }
+		UseBuiltinScene(*s);
+		return main_ImageStreamed(h, w, band);
+	}
+	if (argc == 3 && std::string(argv[1]) == "--reference") return main_Reference(argv[2]);
+	if (argc == 2 && std::string(argv[1]) == "--matrix") return main_Matrix();
+	if (argc == 2 && std::string(argv[1]) == "--list-scenes")
+	{
+		for (const BuiltinScene &s : BuiltinScenes()) std::cout << s.name << ": " << s.description << std::endl;
+		return 0;
+	}
+
+	//Tracer statistics for a built-in scene: --stats name [file.json]. Needs CGI_STATS
+	if (argc >= 3 && std::string(argv[1]) == "--stats") return main_Stats(argv[2], argc > 3 ? argv[3] : "");
+
+	//Hardware counters around building, rendering and saving a built-in scene: --perf name
+	if (argc == 3 && std::string(argv[1]) == "--perf") return main_Perf(argv[2]);
+
+	//Per-pixel render cost of a built-in scene: --heatmap name [heatmap.png]
+	if (argc >= 3 && std::string(argv[1]) == "--heatmap") return main_Heatmap(argv[2], argc > 3 ? argv[3] : "heatmap.png");
+
+	//Convergence study: --converge name [count] [file.csv], error at 1, 2, 4... 2^count samples
+	if (argc >= 3 && std::string(argv[1]) == "--converge")
+	{
+		const BuiltinScene *s = FindBuiltinScene(argv[2]);
+		if (!s) { std::cout << "Unknown scene " << argv[2] << std::endl; return 1; }
+		return main_VariedSampling(*s, 1, 2, argc > 3 ? std::atoi(argv[3]) : 10, argc > 4 ? argv[4] : "");
+	}
+
+	//Performance gate: --regress [tolerance], exit code 1 on a regression; --regress-update records the baseline
+	if (argc >= 2 && std::string(argv[1]) == "--regress") return main_Regression(argc > 2 ? std::atof(argv[2]) : 0.3);
+	if (argc == 2 && std::string(argv[1]) == "--regress-update") return main_Regression(0.0, true);
+
+	//Self-checks of the loaders: --selftest, exit code 1 on a failure
+	if (argc == 2 && std::string(argv[1]) == "--selftest") return main_SelfTest();
+
+	//Text to binary scene conversion: --convert objects.txt scene.bin
+	if (argc == 4 && std::string(argv[1]) == "--convert") return main_ConvertScene(argv[2], argv[3]);
+
+	//Generated scene: --generate field|flake|grid count [seed]. See SceneGenerator.h
+	if (argc >= 4 && std::string(argv[1]) == "--generate")
+	{
+		TRACE_SCOPE("generate scene");
+		SceneGenSettings settings;
+		if (argc > 4) settings.seed = std::strtoull(argv[4], nullptr, 10);
+		if (GenerateScene(scene, argv[2], std::strtoull(argv[3], nullptr, 10), settings))
+		{
+			std::cout << "Unknown scene kind " << argv[2] << std::endl;
+			return 1;
+		}
+		std::cout << "Generated " << scene.Primitives() << " primitives" << std::endl;
+	}
+	//Scene file given on the command line, text (e.g. objects.txt) or binary. See SceneFile.h for the formats
+	else if (argc > 1)
+	{
+		TRACE_SCOPE("load scene");
+		std::string error;
+		auto start = std::chrono::steady_clock::now();
+		if (LoadSceneFile(argv[1], scene, &error))
+		{
+			std::cout << error << std::endl;
+			return 1;
+		}
+		std::cout << "Loaded " << scene.Primitives() << " primitives in "
+				  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+	}
+	else BuiltinScenes()[0].build(scene);		//Two coloured lights; see Scenes.h for the others
+
+	//Triangle mesh from an OBJ file
 	/*
-	objects.push_back(
-		new Sphere(	{ 0.0, 2.0, 0.0 }, 1.0,
-					{ 1.0, 1.0, 1.0 },
-					{ 1.0, 1.0, 1.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ -2.0, 1.0, 0.0 }, 0.4,
-					{ 1.0, 0.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ -1.1, 0.3, 0.0 }, 0.4,
-					{ 1.0, 1.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 0.0 }, 0.4,
-					{ 0.0, 1.0, 0.0 })
-	);
-	objects.push_back(
-		new Sphere(	{ 1.1, 0.3, 0.0 }, 0.4,
-					{ 0.0, 1.0, 0.1 })
-	);
-	objects.push_back(
-		new Sphere(	{ 2.0, 1.0, 0.0 }, 0.4,
-					{ 0.0, 0.0, 0.1 })
-	);*/
-
-	//Cornell box
+	TriangleMesh model;
+	std::string error;
+	if (LoadOBJ("model.obj", model, &error)) std::cout << error << std::endl;
+	scene.AddMesh(	&model,
+					{ 0.8, 0.8, 0.8 });*/
+
+	//Grid of instances of one mesh
 	/*
-	objects.push_back(
-		new Sphere(	{ 0.0, -10.0, 5.0 }, 7.1,
-					{ 1.0, 1.0, 1.0 })
-	);//Floor
-	objects.push_back(
-		new Sphere(	{ 0.0, 10.0, 5.0 }, 5.0,
-					{ 1.0, 1.0, 1.0 },
-					{ 1.0, 1.0, 1.0 })
-	);//Ceiling lamp
-	objects.push_back(
-		new Sphere(	{ 0.0, 0.0, 15.0 }, 7.1,
-					{ 1.0, 1.0, 1.0 })
-	);//Back wall
-	objects.push_back(
-		new Sphere(	{ -10.0, 0.0, 5.0 }, 7.1,
-					{ 1.0, 0.0, 0.0 })
-	);//Left wall, red
-	objects.push_back(
-		new Sphere(	{ 10.0, 0.0, 5.0 }, 7.1,
-					{ 0.0, 1.0, 0.0 })
-	);//Right wall, green
-	objects.push_back(
-		new Sphere(	{ 1.0, -1.0, 3.5 }, 0.9,
-					{ 1.0, 1.0, 1.0 })
-	);//Right sphere, small
-	objects.push_back(
-		new Sphere(	{ -1.0, 0.0, 6.0 }, 1.2,
-					{ 1.0, 1.0, 1.0 })
-	);//Left sphere, larger
-	*/
+	TriangleMesh model;
+	InstanceSet grid;
+	if (LoadOBJ("model.obj", model)) std::cout << "Could not load model.obj" << std::endl;
+	for (int i = -5; i <= 5; i++)
+		for (int j = -5; j <= 5; j++)
+			grid.Add(&model, Transform::Translate({ 0.5*i, 0.5*j, 4.0 }) * Transform::Rotate({ 0.0, 1.0, 0.0 }, 15.0*(i + j)) * Transform::Scale(0.2));
+	grid.Build();
+	scene.AddInstances(	&grid,
+						{ 0.8, 0.8, 0.8 });*/
+
+	{
+		TRACE_SCOPE("build scene");
+		scene.Build();
+	}
 
 	//main_Samples(1, 4, 100);
 	main_Image(200, 200);
+	//main_ImageStreamed(20000, 30000);
 	//main_SinglePixel(100);
-	//main_VariedSampling(1, 2, 15);
+	//main_VariedSampling(BuiltinScenes()[0], 1, 2, 15);
 	std::cout << "Done" << std::endl; cin.get();	
 	return 0;
 }
\ No newline at end of file
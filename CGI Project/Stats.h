@@ -0,0 +1,125 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+
+/*----Render statistics----*/
+//Counters for what the tracer does with its samples, compiled in only when CGI_STATS is
+//defined (e.g. -DCGI_STATS); otherwise the STAT macros expand to nothing. Each thread
+//counts into its own block, without atomics, and a block is added to the global total
+//when its thread exits. ParallelFor joins its workers before returning, so once a render
+//is done StatsTotal() covers all of it.
+
+#ifdef CGI_STATS
+const bool StatsEnabled = true;
+#define STAT(field) (ThreadStats().field++)
+#define STAT_ADD(field, n) (ThreadStats().field += (n))
+#else
+const bool StatsEnabled = false;
+#define STAT(field) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#endif
+
+struct RenderStats
+{
+	static const int MaxDepth = 32;		//Deeper bounces are counted in the last slot
+
+	uint64_t raysPerDepth[MaxDepth] = {},
+			 hits = 0, misses = 0,			//Misses return the background colour
+			 primitiveTests = 0,			//Scene primitives, meshes and instances each counting once
+			 triangleTests = 0,
+			 nodeVisits = 0,				//BVH nodes, scene and mesh
+			 rouletteKills = 0,				//Paths ended by Russian roulette
+			 bounceCaps = 0;				//Paths cut off at PathTracingBounces
+
+	RenderStats &operator+=(const RenderStats &o)
+	{
+		for (int d = 0; d < MaxDepth; d++) raysPerDepth[d] += o.raysPerDepth[d];
+		hits += o.hits; misses += o.misses;
+		primitiveTests += o.primitiveTests; triangleTests += o.triangleTests; nodeVisits += o.nodeVisits;
+		rouletteKills += o.rouletteKills; bounceCaps += o.bounceCaps;
+		return *this;
+	}
+
+	uint64_t Rays() const { return hits + misses; }
+	double PerRay(uint64_t n) const { return Rays() ? double(n) / Rays() : 0.0; }
+
+	int Depths() const		//One past the deepest bounce that cast a ray
+	{
+		int n = MaxDepth;
+		while (n > 0 && raysPerDepth[n - 1] == 0) n--;
+		return n;
+	}
+
+	void Print(std::ostream &os) const
+	{
+		os << "rays: " << Rays() << " (" << hits << " hits, " << misses << " misses, "
+		   << 100.0 * PerRay(misses) << "% to background)" << std::endl
+		   << "per ray: " << PerRay(primitiveTests) << " primitive tests, " << PerRay(triangleTests)
+		   << " triangle tests, " << PerRay(nodeVisits) << " BVH nodes" << std::endl
+		   << "paths ended: " << rouletteKills << " by Russian roulette, " << bounceCaps << " at the bounce limit" << std::endl
+		   << "rays per bounce:";
+		for (int d = 0; d < Depths(); d++) os << " " << raysPerDepth[d];
+		os << std::endl;
+	}
+
+	void WriteJSON(std::ostream &os) const
+	{
+		os << "{\n  \"rays\": " << Rays() << ",\n  \"hits\": " << hits << ",\n  \"misses\": " << misses
+		   << ",\n  \"primitive_tests\": " << primitiveTests << ",\n  \"triangle_tests\": " << triangleTests
+		   << ",\n  \"node_visits\": " << nodeVisits << ",\n  \"roulette_kills\": " << rouletteKills
+		   << ",\n  \"bounce_caps\": " << bounceCaps << ",\n  \"rays_per_depth\": [";
+		for (int d = 0; d < Depths(); d++) os << (d ? ", " : "") << raysPerDepth[d];
+		os << "]\n}" << std::endl;
+	}
+};
+
+struct StatsTotals
+{
+	std::mutex lock;
+	RenderStats total;		//Of threads that have exited
+};
+
+inline StatsTotals &GlobalStats()
+{
+	static StatsTotals totals;
+	return totals;
+}
+
+struct ThreadStatsBlock
+{
+	RenderStats stats;
+	~ThreadStatsBlock()
+	{
+		std::lock_guard<std::mutex> guard(GlobalStats().lock);
+		GlobalStats().total += stats;
+	}
+};
+
+// This thread's counters
+inline RenderStats &ThreadStats()
+{
+	thread_local ThreadStatsBlock block;
+	return block.stats;
+}
+
+// Counts of exited threads and the calling one. Other live threads are not included
+inline RenderStats StatsTotal()
+{
+	std::lock_guard<std::mutex> guard(GlobalStats().lock);
+	RenderStats total = GlobalStats().total;
+	return total += ThreadStats();
+}
+
+inline void ResetStats()
+{
+	std::lock_guard<std::mutex> guard(GlobalStats().lock);
+	GlobalStats().total = RenderStats();
+	ThreadStats() = RenderStats();
+}
+
+#endif
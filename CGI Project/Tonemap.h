@@ -0,0 +1,174 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TONEMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/*----Settings----*/
+
+enum class ToneOperator
+{
+	Clamp,		//min(v, 1), the original behaviour of Image::Save
+	Reinhard,	//v / (1 + v)
+	ACES,		//Narkowicz's fit of the ACES filmic curve
+	Exposure	//1 - exp(-v)
+};
+
+enum class TransferCurve
+{
+	Gamma22,	//v^(1/2.2)
+	sRGB		//Piecewise sRGB OETF
+};
+
+struct ToneMapSettings
+{
+	ToneOperator op = ToneOperator::Clamp;
+	TransferCurve curve = TransferCurve::Gamma22;
+	float exposure = 1.0f;		//Linear scale applied before the operator
+};
+
+
+/*----Operators----*/
+//Each operator maps a non-negative radiance value to [0, 1], four lanes at a time where SSE2 is available
+
+struct ClampOp
+{
+	static float Map(float v) { return std::min(v, 1.0f); }
+#ifdef TONEMAP_SSE2
+	static __m128 Map(__m128 v) { return _mm_min_ps(v, _mm_set1_ps(1.0f)); }
+#endif
+};
+
+struct ReinhardOp
+{
+	static float Map(float v) { return 1.0f - 1.0f / (1.0f + v); }		//Same as v / (1 + v), but inf maps to 1
+#ifdef TONEMAP_SSE2
+	static __m128 Map(__m128 v) { return _mm_sub_ps(_mm_set1_ps(1.0f), _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_set1_ps(1.0f), v))); }
+#endif
+};
+
+struct ACESOp		//v is clamped first, as the rational is inf/inf = NaN for inf or anything past about 1e19
+{
+	static float Map(float v)
+	{
+		v = std::min(v, 1e4f);		//Already maps to 1
+		return std::min((v*(2.51f*v + 0.03f)) / (v*(2.43f*v + 0.59f) + 0.14f), 1.0f);
+	}
+#ifdef TONEMAP_SSE2
+	static __m128 Map(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_set1_ps(1e4f));
+		__m128	num = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), v), _mm_set1_ps(0.03f))),
+				den = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), v), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		return _mm_min_ps(_mm_div_ps(num, den), _mm_set1_ps(1.0f));
+	}
+#endif
+};
+
+struct ExposureOp
+{
+	static float Map(float v) { return 1.0f - std::exp(-v); }
+#ifdef TONEMAP_SSE2
+	static __m128 Map(__m128 v)		//No SSE2 exp, the lanes are done one by one
+	{
+		alignas(16) float lane[4];
+		_mm_store_ps(lane, v);
+		for (int i = 0; i < 4; i++) lane[i] = Map(lane[i]);
+		return _mm_load_ps(lane);
+	}
+#endif
+};
+
+
+/*----Tone mapper----*/
+
+class ToneMapper
+{
+public:
+	static const int LUTSize = 1 << 16;		//Fine enough that the darkest codes stay within one level of std::pow
+
+	ToneMapper(const ToneMapSettings &s = ToneMapSettings()) : settings(s), lut(Lut(s.curve)) {}
+
+	// Map n linear values to 8-bit display values. Channels are independent, so any interleaving works
+	void Apply(const float *src, unsigned char *dst, int n) const
+	{
+		switch (settings.op)
+		{
+		case ToneOperator::Clamp:		Run<ClampOp>(src, dst, n); break;
+		case ToneOperator::Reinhard:	Run<ReinhardOp>(src, dst, n); break;
+		case ToneOperator::ACES:		Run<ACESOp>(src, dst, n); break;
+		case ToneOperator::Exposure:	Run<ExposureOp>(src, dst, n); break;
+		}
+	}
+
+	// Precomputed transfer curve: LUT[i] = 8-bit code of i / (LUTSize - 1)
+	static const std::vector<unsigned char> &Lut(TransferCurve curve)
+	{
+		static const std::vector<unsigned char> gamma22 = BuildLut(TransferCurve::Gamma22),
+												srgb = BuildLut(TransferCurve::sRGB);
+		return curve == TransferCurve::sRGB ? srgb : gamma22;
+	}
+
+private:
+	ToneMapSettings settings;
+	const std::vector<unsigned char> &lut;
+
+	static std::vector<unsigned char> BuildLut(TransferCurve curve)
+	{
+		std::vector<unsigned char> table(LUTSize);
+		for (int i = 0; i < LUTSize; i++)
+		{
+			double a = double(i) / (LUTSize - 1);
+			if (curve == TransferCurve::sRGB)
+				a = (a <= 0.0031308) ? 12.92*a : 1.055*std::pow(a, 1 / 2.4) - 0.055;
+			else
+				a = std::pow(a, 1 / 2.2);
+			table[i] = (unsigned char)(255.0*a);
+		}
+		return table;
+	}
+
+	template<class Op>
+	void Run(const float *src, unsigned char *dst, int n) const
+	{
+		const int Block = 256;
+		const float scale = float(LUTSize - 1);
+		const unsigned char *table = lut.data();
+		alignas(16) int index[Block];
+
+		for (int start = 0; start < n; start += Block)
+		{
+			int count = std::min(Block, n - start), i = 0;
+			const float *s = src + start;
+
+#ifdef TONEMAP_SSE2
+			const __m128 exposure = _mm_set1_ps(settings.exposure), zero = _mm_setzero_ps(),
+						 one = _mm_set1_ps(1.0f), vscale = _mm_set1_ps(scale), half = _mm_set1_ps(0.5f);
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i), exposure), zero);	//NaN lanes become 0
+				v = _mm_min_ps(_mm_max_ps(Op::Map(v), zero), one);		//Keeps each operator's output inside the table
+				v = _mm_add_ps(_mm_mul_ps(v, vscale), half);
+				_mm_store_si128((__m128i*)(index + i), _mm_cvttps_epi32(v));
+			}
+#endif
+			for (; i < count; i++)
+			{
+				float v = std::max(0.0f, s[i] * settings.exposure);
+				index[i] = int(std::min(std::max(0.0f, Op::Map(v)), 1.0f)*scale + 0.5f);
+			}
+
+			for (i = 0; i < count; i++)
+				dst[start + i] = table[index[i]];
+		}
+	}
+};
+
+#endif
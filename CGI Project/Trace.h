@@ -0,0 +1,157 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*----Timeline tracing----*/
+//Scoped events (phases, tiles, parallel blocks) recorded per thread and written at exit
+//as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev. Off unless StartTrace is
+//called, and then a TRACE_SCOPE costs one relaxed load. Each thread appends to its own
+//buffer with no locking. A buffer is taken on the thread's first event and handed back
+//when the thread exits, for the next new thread to carry on, so the short-lived workers
+//ParallelFor starts for every call share a few timeline rows rather than one row each.
+
+struct TraceEvent
+{
+	const char *name;			//Static strings only
+	uint64_t start, duration;	//Nanoseconds since the trace started
+	int x, y;					//Optional arguments, e.g. a tile's corner; -1 if unused
+};
+
+struct TraceBuffer
+{
+	int thread;
+	std::vector<TraceEvent> events;
+};
+
+struct TraceState
+{
+	std::atomic<bool> enabled{ false };
+	std::chrono::steady_clock::time_point start;
+	std::string filename;
+
+	std::mutex lock;			//Guards buffers and free, only taken as threads start and exit
+	std::vector<std::unique_ptr<TraceBuffer> > buffers;
+	std::vector<TraceBuffer*> free;		//Of exited threads
+};
+
+inline TraceState &Tracing()
+{
+	static TraceState state;
+	return state;
+}
+
+inline bool TraceEnabled() { return Tracing().enabled.load(std::memory_order_relaxed); }
+
+inline uint64_t TraceNow()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Tracing().start).count());
+}
+
+struct ThreadTraceSlot
+{
+	TraceBuffer *buffer = nullptr;
+	~ThreadTraceSlot()
+	{
+		if (!buffer) return;
+		std::lock_guard<std::mutex> guard(Tracing().lock);
+		Tracing().free.push_back(buffer);
+	}
+};
+
+inline TraceBuffer &ThreadTraceBuffer()
+{
+	thread_local ThreadTraceSlot slot;
+	if (!slot.buffer)
+	{
+		TraceState &t = Tracing();
+		std::lock_guard<std::mutex> guard(t.lock);
+		if (!t.free.empty())
+		{
+			slot.buffer = t.free.back();
+			t.free.pop_back();
+		}
+		else
+		{
+			t.buffers.emplace_back(new TraceBuffer{ int(t.buffers.size()), {} });
+			slot.buffer = t.buffers.back().get();
+		}
+	}
+	return *slot.buffer;
+}
+
+// Write the recorded events. Call after all traced threads have finished
+inline int WriteTrace(const std::string &filename)
+{
+	TraceState &t = Tracing();
+	std::lock_guard<std::mutex> guard(t.lock);
+	std::ofstream ofs(filename);
+	if (!ofs.is_open()) return 1;
+
+	ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	ofs << std::fixed << std::setprecision(3);		//Microseconds, to the nanosecond
+	bool first = true;
+	for (const auto &b : t.buffers)
+	{
+		ofs << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->thread
+			<< ", \"args\": {\"name\": \"" << (b->thread ? "worker " + std::to_string(b->thread) : std::string("main")) << "\"}}";
+		first = false;
+		for (const TraceEvent &e : b->events)
+		{
+			ofs << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->thread
+				<< ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << e.duration / 1000.0;
+			if (e.x >= 0) ofs << ", \"args\": {\"x\": " << e.x << ", \"y\": " << e.y << "}";
+			ofs << "}";
+		}
+	}
+	ofs << "\n]}" << std::endl;
+	return ofs.good() ? 0 : 1;
+}
+
+// Start recording, writing to filename when the program exits. The calling thread is
+// listed as the main thread
+inline void StartTrace(const std::string &filename)
+{
+	TraceState &t = Tracing();
+	t.filename = filename;
+	t.start = std::chrono::steady_clock::now();
+	ThreadTraceBuffer();
+	t.enabled = true;
+	std::atexit([]() { WriteTrace(Tracing().filename); });
+}
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char *name, int x = -1, int y = -1)
+		: name(TraceEnabled() ? name : nullptr), x(x), y(y), start(this->name ? TraceNow() : 0) {}
+
+	~TraceScope()
+	{
+		if (name) ThreadTraceBuffer().events.push_back({ name, start, TraceNow() - start, x, y });
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope &operator=(const TraceScope&) = delete;
+
+private:
+	const char *name;
+	int x, y;
+	uint64_t start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+#include "Vec3.h"
+
+// Affine transform: a 4x4 matrix whose last row is always (0, 0, 0, 1), so only the
+// top three rows are stored. Fixed size and inline, unlike the general Matrix in
+// matrix.h, since instances apply it to every ray they test.
+
+struct Transform
+{
+	double m[3][4];
+
+	static Transform Identity()
+	{
+		return { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } };
+	}
+
+	static Transform Translate(const Vec3 &t)
+	{
+		return { { { 1, 0, 0, t.x }, { 0, 1, 0, t.y }, { 0, 0, 1, t.z } } };
+	}
+
+	static Transform Scale(const Vec3 &s)
+	{
+		return { { { s.x, 0, 0, 0 }, { 0, s.y, 0, 0 }, { 0, 0, s.z, 0 } } };
+	}
+
+	static Transform Scale(double s) { return Scale(Vec3(s, s, s)); }
+
+	// Rotation by angle degrees about axis, right-handed
+	static Transform Rotate(Vec3 axis, double degrees)
+	{
+		axis.normalise();
+		double	a = degrees * 4.0*std::atan(1.0) / 180.0,
+				c = std::cos(a), s = std::sin(a), t = 1.0 - c,
+				x = axis.x, y = axis.y, z = axis.z;
+		return { { { t*x*x + c,   t*x*y - s*z, t*x*z + s*y, 0 },
+				   { t*x*y + s*z, t*y*y + c,   t*y*z - s*x, 0 },
+				   { t*x*z - s*y, t*y*z + s*x, t*z*z + c,   0 } } };
+	}
+
+	// this * rhs: rhs is applied first
+	Transform operator*(const Transform &rhs) const
+	{
+		Transform r;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+				r.m[i][j] = m[i][0]*rhs.m[0][j] + m[i][1]*rhs.m[1][j] + m[i][2]*rhs.m[2][j];
+			r.m[i][3] += m[i][3];
+		}
+		return r;
+	}
+
+	Vec3 Point(const Vec3 &p) const
+	{
+		return Vec3(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+					m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+					m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+	}
+
+	Vec3 Vector(const Vec3 &v) const
+	{
+		return Vec3(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+					m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+					m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+	}
+
+	// Multiply by the transpose of the linear part. Called on the inverse transform, this
+	// carries a normal from local to world space
+	Vec3 TransposeVector(const Vec3 &n) const
+	{
+		return Vec3(m[0][0]*n.x + m[1][0]*n.y + m[2][0]*n.z,
+					m[0][1]*n.x + m[1][1]*n.y + m[2][1]*n.z,
+					m[0][2]*n.x + m[1][2]*n.y + m[2][2]*n.z);
+	}
+
+	// Inverse via the adjugate of the linear part. A singular transform gives non-finite values
+	Transform Inverse() const
+	{
+		double	a = m[0][0], b = m[0][1], c = m[0][2],
+				d = m[1][0], e = m[1][1], f = m[1][2],
+				g = m[2][0], h = m[2][1], k = m[2][2],
+				invDet = 1.0 / (a*(e*k - f*h) - b*(d*k - f*g) + c*(d*h - e*g));
+
+		Transform r = { { { (e*k - f*h)*invDet, (c*h - b*k)*invDet, (b*f - c*e)*invDet, 0 },
+						  { (f*g - d*k)*invDet, (a*k - c*g)*invDet, (c*d - a*f)*invDet, 0 },
+						  { (d*h - e*g)*invDet, (b*g - a*h)*invDet, (a*e - b*d)*invDet, 0 } } };
+		Vec3 t = r.Vector(Vec3(m[0][3], m[1][3], m[2][3]));
+		r.m[0][3] = -t.x; r.m[1][3] = -t.y; r.m[2][3] = -t.z;
+		return r;
+	}
+};
+
+#endif
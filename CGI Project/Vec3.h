@@ -108,6 +108,16 @@ inline Vec3 cross(const Vec3 &a, const Vec3 &b) {
                 a.x*b.y - a.y*b.x);
 }
 
+// Compact single precision storage, for framebuffers and mesh vertices. Maths is done in Vec3
+struct Vec3f
+{
+	float x, y, z;
+};
+
+inline Vec3 ToVec3(const Vec3f &v) {
+    return Vec3(v.x, v.y, v.z);
+}
+
 // ostream output
 inline std::ostream &operator<<(std::ostream &os, const Vec3 &v) {
     os << "(" << v.x << ", " << v.y << ", " << v.z << ")";
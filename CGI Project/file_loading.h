@@ -1,14 +1,82 @@
+#ifndef FILE_LOADING_H
+#define FILE_LOADING_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
 #include <sstream>
+#include <string_view>
+#include <type_traits>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <vector>
 #include <fstream>
+#include "MappedFile.h"
+#include "Parallel.h"
 using namespace std;
 
 
+// Read a whole file into one buffer with a single read. Returns 0 on success, 1 on error
+inline int ReadWholeFile(const string &filename, string &buffer)
+{
+	ifstream ifs(filename, ios::binary | ios::ate);
+	if (!ifs.is_open()) return 1;
+
+	streamoff size = ifs.tellg();
+	if (size < 0) return 1;
+	buffer.resize(size_t(size));
+	ifs.seekg(0);
+	if (size > 0 && !ifs.read(&buffer[0], size)) return 1;
+	return 0;
+}
+
+
+inline bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+// Parse a double from [p, end) after any blanks, accepting what >> accepts: an optional
+// sign then a decimal number, so no inf or nan. Returns the position after it, or nullptr
+inline const char *ParseDouble(const char *p, const char *end, double &value)
+{
+	while (p < end && IsBlank(*p)) p++;
+
+	const char *digits = (p < end && (*p == '+' || *p == '-')) ? p + 1 : p;
+	if (digits == end || !((*digits >= '0' && *digits <= '9') || *digits == '.')) return nullptr;
+	if (*p == '+') p++;			//from_chars takes '-' but not '+'
+
+	from_chars_result r = from_chars(p, end, value);
+	if (r.ec == errc::result_out_of_range)		//Underflow reads as zero, as with >>; overflow is an error
+	{
+		double v = strtod(string(p, r.ptr).c_str(), nullptr);
+		if (std::isinf(v)) return nullptr;
+		value = v;
+	}
+	else if (r.ec != errc()) return nullptr;
+	return r.ptr;
+}
+
+// Parse one comma-separated double from [p, end). Surrounding blanks and the comma
+// after the value are skipped. Returns the position after the field, or nullptr if
+// there is no number there or it is followed by anything else
+inline const char *ParseDoubleField(const char *p, const char *end, double &value)
+{
+	if (!(p = ParseDouble(p, end, value))) return nullptr;
+
+	while (p < end && IsBlank(*p)) p++;
+	if (p < end)
+	{
+		if (*p != ',') return nullptr;
+		p++;
+	}
+	return p;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 // Class DoubleCSVFile reads lines of comma-separated floating-point variables
-// from an input stream and stores the data it has read.
+// from an input stream or file and stores the data it has read.
+// All values are kept in one row-major array, with the start of each row in a
+// second array, instead of a vector per line.
 
 class DoubleCSVFile
 {
@@ -19,56 +87,188 @@ public:
 		string line;
 		while (getline(inputStream, line)) // Get a line of data from the file and store in 'line'
 		{
-			vector<double> lineData;
-
 			// processes the line just read; if processing fails, return with an error
-			if (ReadLineOfDoubles(line, lineData)) return 1;
-			else fileData.push_back(lineData); // otherwise, add line to stored data
+			if (AppendLine(line.data(), line.data() + line.size())) return 1;
 		}
 		return 0;
 	}
 
+	// Load doubles from a file, for large inputs. The file is mapped (or read whole), cut
+	// into chunks at line ends and the chunks parsed in parallel straight into the store.
+	// Same results as Load: returns 1 at the first bad line, keeping the lines before it
+	int LoadFile(const string &filename)
+	{
+		MappedFile mapped;
+		string buffer;
+		const char *data;
+		size_t size;
+
+		if (!mapped.Open(filename))
+		{
+			data = reinterpret_cast<const char*>(mapped.Data());
+			size = mapped.Size();
+		}
+		else
+		{
+			if (ReadWholeFile(filename, buffer)) return 1;
+			data = buffer.data();
+			size = buffer.size();
+		}
+		return Parse(data, size);
+	}
+
 	// Display the stored data to cout
 	void DisplayValues()
 	{
-		unsigned nLines = fileData.size();
-		cout << "File has " << fileData.size() << " line(s):" << endl;
-		for (unsigned line = 0; line < nLines; line++)
+		size_t nLines = Rows();
+		cout << "File has " << nLines << " line(s):" << endl;
+		for (size_t line = 0; line < nLines; line++)
 		{
-			vector<double> &lineRef = fileData[line];
-			cout << "  Line " << line << " has " << lineRef.size() << " item(s):" << endl;
-			for (vector<double>::iterator i = lineRef.begin(); i != lineRef.end(); i++)
+			cout << "  Line " << line << " has " << RowSize(line) << " item(s):" << endl;
+			for (const double *i = Row(line); i != Row(line) + RowSize(line); i++)
 				cout << "    " << *i << endl;
 		}
 	}
 
+	size_t Rows() const { return rowStart.size() - 1; }
+	size_t RowSize(size_t row) const { return rowStart[row + 1] - rowStart[row]; }
+	const double *Row(size_t row) const { return values.data() + rowStart[row]; }
+	const vector<double> &Values() const { return values; }
+
+	// Line of the error that stopped the last load, counting from 1 within that load; 0 if none
+	size_t ErrorLine() const { return errorLine; }
+
 protected:
-	// Read a line of comma-separated doubles from a string, and store doubles in a vector
-	// This method makes an istringstream out of the line that is passed in, and uses the 
-	// extraction operator >> on this new input stream to read double variables from it
-	int ReadLineOfDoubles(const string &line, vector<double> &lineData)
+	// Read a line of comma-separated doubles from [p, end) into out, which must have room
+	// for one more value than there are commas. Returns 0 on success, 1 on error
+	static int ReadLineOfDoubles(const char *p, const char *end, double *out, size_t &count)
 	{
-		istringstream iss(line); // make a new stream just containing the data for this line
-		double d;
-		char c;
-
+		count = 0;
 		while (true)
 		{
-			if (!(iss >> d)) return 1; // if we can't read a double, error
-			lineData.push_back(d);
+			if (!(p = ParseDouble(p, end, out[count]))) return 1; // if we can't read a double, error
+			count++;
+
+			while (p < end && IsBlank(*p)) p++;
+			if (p == end) return 0; // the number last read was the last thing on the line
+			if (*p != ',') return 1; // anything after a number must be a comma
+			p++;
+		}
+	}
 
-			if (iss >> c) // if there is a character to read after the number...
+	static size_t CountCommas(const char *p, const char *end)
+	{
+		size_t n = 0;
+		for (; p < end; p++) n += (*p == ',');
+		return n;
+	}
+
+	int AppendLine(const char *p, const char *end)
+	{
+		size_t first = values.size(), count;
+		values.resize(first + CountCommas(p, end) + 1);
+		int err = ReadLineOfDoubles(p, end, values.data() + first, count);
+		values.resize(err ? first : first + count);
+		if (!err) rowStart.push_back(values.size());
+		return err;
+	}
+
+	// Two passes over chunks of whole lines. The first counts lines and commas, which
+	// bound each chunk's rows and values, so the second can parse every chunk directly
+	// into its own part of the store
+	int Parse(const char *data, size_t size)
+	{
+		size_t chunkSize = max(size_t(1) << 20, size / (size_t(ThreadCount()) * 4) + 1);
+		vector<const char*> bounds(1, data);
+		while (bounds.back() < data + size)
+		{
+			const char *end = bounds.back() + min(chunkSize, size_t(data + size - bounds.back()));
+			while (end < data + size && end[-1] != '\n') end++;
+			bounds.push_back(end);
+		}
+
+		int nChunks = int(bounds.size()) - 1;
+		struct Chunk { size_t lines, maxValues, rows, errorLine; };
+		vector<Chunk> chunks(nChunks);
+
+		ParallelFor(0, nChunks, 1, [&](int lo, int hi)
+		{
+			for (int c = lo; c < hi; c++)
 			{
-				// it must be a comma, otherwise there is an error
-				if (c != ',') return 1;
+				size_t lines = 0, commas = 0;
+				for (const char *p = bounds[c]; p < bounds[c + 1]; p++)
+				{
+					lines += (*p == '\n');
+					commas += (*p == ',');
+				}
+				if (bounds[c + 1][-1] != '\n') lines++;		//Last line of the file without a newline
+				chunks[c] = { lines, commas + lines, 0, 0 };
 			}
-			else return 0;// the number last read was the last thing on the line
+		});
+
+		size_t valueBase = values.size(), rowBase = Rows();
+		vector<size_t> valueOffset(nChunks + 1, valueBase), rowOffset(nChunks + 1, rowBase);
+		for (int c = 0; c < nChunks; c++)
+		{
+			valueOffset[c + 1] = valueOffset[c] + chunks[c].maxValues;
+			rowOffset[c + 1] = rowOffset[c] + chunks[c].lines;
+		}
+		values.resize(valueOffset[nChunks]);
+		rowStart.resize(rowOffset[nChunks] + 1);
+
+		// Row starts are written relative to the chunk, then shifted once the chunk sizes are known
+		ParallelFor(0, nChunks, 1, [&](int lo, int hi)
+		{
+			for (int c = lo; c < hi; c++)
+			{
+				double *out = values.data() + valueOffset[c];
+				size_t *starts = rowStart.data() + rowOffset[c] + 1, used = 0, count;
+				const char *p = bounds[c], *end = bounds[c + 1];
+
+				while (p < end)
+				{
+					const char *eol = p;
+					while (eol < end && *eol != '\n') eol++;
+					if (ReadLineOfDoubles(p, eol, out + used, count))
+					{
+						chunks[c].errorLine = chunks[c].rows + 1;
+						break;
+					}
+					used += count;
+					starts[chunks[c].rows++] = used;
+					p = eol + 1;
+				}
+			}
+		});
+
+		// A chunk of good lines fills exactly the space counted for it, so everything up to
+		// the first bad line is already in place; only the row starts need shifting
+		int kept = 0;
+		size_t lineBase = 0;
+		errorLine = 0;
+		while (kept < nChunks && !errorLine)
+		{
+			if (chunks[kept].errorLine) errorLine = lineBase + chunks[kept].errorLine;
+			lineBase += chunks[kept++].lines;
 		}
+
+		ParallelFor(0, kept, 1, [&](int lo, int hi)
+		{
+			for (int c = lo; c < hi; c++)
+				for (size_t r = rowOffset[c] + 1; r <= rowOffset[c] + chunks[c].rows; r++) rowStart[r] += valueOffset[c];
+		});
+
+		size_t rows = kept ? rowOffset[kept - 1] + chunks[kept - 1].rows : rowBase;
+		values.resize(rowStart[rows]);
+		rowStart.resize(rows + 1);
+		return errorLine ? 1 : 0;
 	}
 
 	// Internal data storage:
-	// fileData[i][j] contains the jth number stored on the ith line of the file
-	vector<vector<double> > fileData;
+	// row i is values[rowStart[i]] to values[rowStart[i + 1] - 1]
+	vector<double> values;
+	vector<size_t> rowStart = { 0 };
+	size_t errorLine = 0;
 };
 
 
@@ -80,7 +280,7 @@ protected:
 class StringCSVFile
 {
 public:
-	// Load comma-separated strings from an input stream. 
+	// Load comma-separated strings from an input stream. Always returns 0
 	int Load(istream &inputStream)
 	{
 		string line;
@@ -90,6 +290,7 @@ public:
 			ReadLineOfStrings(line, stringList); // Read line into storage
 			fileData.push_back(stringList); // store data for this line in data for the file
 		}
+		return 0;
 	}
 
 	// Display the stored data to cout
@@ -143,9 +344,172 @@ protected:
 			if (index != string::npos) *i = i->substr(index); // ...and cut off the characters before it.
 			else *i = string(); // If there are no non-whitespace characters, return an empty string
 		}
+		return 0;
 	}
 
 	// Internal data storage:
 	// fileData[i][j] contains the jth string stored on the ith line of the file
 	vector<vector<string> > fileData;
 };
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Class StringViewCSVFile reads comma-separated strings like StringCSVFile, but
+// without copying them. The file is held in one buffer and every cell is an
+// offset and length into it, trimmed of spaces and tabs, found through a flat
+// cell array and row offsets. Cells are returned as string_views, built on
+// access, so a copied or moved object reads its own buffer. With a header row,
+// columns can be looked up by name and converted to numbers in one call.
+
+class StringViewCSVFile
+{
+public:
+	// Load comma-separated strings from an input stream. Returns 0 on success, 1 on error
+	int Load(istream &inputStream)
+	{
+		buffer.assign(istreambuf_iterator<char>(inputStream), istreambuf_iterator<char>());
+		if (inputStream.bad()) return 1;
+		Split();
+		return 0;
+	}
+
+	// Load comma-separated strings from a file in a single read. Returns 0 on success, 1 on error
+	int LoadFile(const string &filename)
+	{
+		if (ReadWholeFile(filename, buffer)) return 1;
+		Split();
+		return 0;
+	}
+
+	// Display the stored data to cout
+	void DisplayValues() const
+	{
+		cout << "File has " << Rows() << " line(s):" << endl;
+		for (size_t line = 0; line < Rows(); line++)
+		{
+			cout << "  Line " << line << " has " << Columns(line) << " item(s):" << endl;
+			for (size_t i = 0; i < Columns(line); i++)
+				cout << "    \"" << (*this)(line, i) << "\"" << endl;
+		}
+	}
+
+	size_t Rows() const { return rowStart.size() - 1; }
+	size_t Columns(size_t row) const { return rowStart[row + 1] - rowStart[row]; }
+
+	// Cell at row, column. Valid until the next load, or until this object is destroyed
+	string_view operator()(size_t row, size_t column) const
+	{
+		const Cell &c = cells[rowStart[row] + column];
+		return string_view(buffer.data() + c.offset, c.length);
+	}
+
+	// Column of the header (row 0) cell equal to name, or -1
+	int ColumnIndex(string_view name) const
+	{
+		for (size_t i = 0; Rows() > 0 && i < Columns(0); i++)
+			if ((*this)(0, i) == name) return int(i);
+		return -1;
+	}
+
+	// Convert the cell at row, column. Returns 0 on success, 1 if it is missing or not a T
+	template<class T>
+	int Get(size_t row, size_t column, T &value) const
+	{
+		if (row >= Rows() || column >= Columns(row)) return 1;
+		return ParseCell((*this)(row, column), value) ? 0 : 1;
+	}
+
+	// Every value below the header in the column named name, converted to T. Returns 0 on
+	// success, 1 on error, with the row of the bad cell (counting the header as 0) in *errorRow
+	template<class T>
+	int GetColumn(string_view name, vector<T> &values, size_t *errorRow = nullptr) const
+	{
+		int column = ColumnIndex(name);
+		if (column < 0)
+		{
+			if (errorRow) *errorRow = 0;
+			return 1;
+		}
+
+		values.resize(Rows() > 0 ? Rows() - 1 : 0);
+		for (size_t row = 1; row < Rows(); row++)
+		{
+			if (Get(row, size_t(column), values[row - 1]))
+			{
+				if (errorRow) *errorRow = row;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+protected:
+	// Whole-cell conversions. Numbers must fill the cell
+	static bool ParseCell(string_view cell, string_view &value) { value = cell; return true; }
+	static bool ParseCell(string_view cell, string &value) { value = string(cell); return true; }
+
+	static bool ParseCell(string_view cell, double &value)
+	{
+		return ParseDouble(cell.data(), cell.data() + cell.size(), value) == cell.data() + cell.size();
+	}
+
+	static bool ParseCell(string_view cell, float &value)
+	{
+		double d;
+		if (!ParseCell(cell, d)) return false;
+		value = float(d);
+		return true;
+	}
+
+	template<class Int, class = typename enable_if<is_integral<Int>::value>::type>
+	static bool ParseCell(string_view cell, Int &value)
+	{
+		const char *p = cell.data(), *end = p + cell.size();
+		if (p < end && *p == '+') p++;
+		from_chars_result r = from_chars(p, end, value);
+		return r.ec == errc() && r.ptr == end && p < end;
+	}
+
+	// Split the buffer into lines and cells. As with getline, a final newline does not start
+	// another line; a '\r' before the newline is dropped
+	void Split()
+	{
+		cells.clear();
+		rowStart.assign(1, 0);
+
+		const char *p = buffer.data(), *end = p + buffer.size();
+		while (p < end)
+		{
+			const char *eol = p;
+			while (eol < end && *eol != '\n') eol++;
+			const char *lineEnd = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+
+			while (true)
+			{
+				const char *comma = p;
+				while (comma < lineEnd && *comma != ',') comma++;
+
+				const char *first = p, *last = comma;	// Trim spaces and tabs from both ends
+				while (first < last && (*first == ' ' || *first == '\t')) first++;
+				while (last > first && (last[-1] == ' ' || last[-1] == '\t')) last--;
+				cells.push_back({ size_t(first - buffer.data()), size_t(last - first) });
+
+				if (comma == lineEnd) break;
+				p = comma + 1;
+			}
+			rowStart.push_back(cells.size());
+			p = eol + 1;
+		}
+	}
+
+	// Internal data storage:
+	// cells of row i are cells[rowStart[i]] to cells[rowStart[i + 1] - 1], each a range of buffer.
+	// Offsets rather than pointers, which a copy or a move (of a short, in-place string) would leave
+	// pointing at the source
+	struct Cell { size_t offset, length; };
+	string buffer;
+	vector<Cell> cells;
+	vector<size_t> rowStart = { 0 };
+};
+
+#endif